@@ -14,6 +14,10 @@ src\driver_init.c
 
 src\la66.c
 
+src\codec.c
+
+src\power.c
+
 src\nvmctrl_basic.c
 
 src\protected_io.S
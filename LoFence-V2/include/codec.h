@@ -0,0 +1,78 @@
+/*!
+@file	codec.h
+@brief	Schema driven bit packing of uplink payloads.
+
+A schema is a PROGMEM byte array, the first byte is the amount of fields
+followed by the bit width of each field (1 - 32). Fields are packed MSB first
+without padding, only the last byte is padded with zero bits.
+The reference decoder is scripts/decoder.js, keep both in sync.
+*/
+
+#ifndef CODEC_H_
+#define CODEC_H_
+
+#include <atmel_start.h>
+
+// V per LSB of the fence voltage fields
+#define CODEC_FENCE_STEP 4
+
+// fPort 1: version flag, battery mV, fence positive V / 4, fence negative V / 4
+extern const uint8_t codec_data[];
+// fPort 1: as codec_data followed by the version
+extern const uint8_t codec_data_version[];
+// fPort 2: version, tdc, daily_confirmed_uplinks
+extern const uint8_t codec_settings_1[];
+// fPort 3: version, max_volt, msr_ms
+extern const uint8_t codec_settings_2[];
+// fPort 4: version, bat_low, bat_low_count_max, bat_low_min
+extern const uint8_t codec_settings_3[];
+// fPort 5: alarm state, fence positive V / 4, fence negative V / 4
+extern const uint8_t codec_alarm[];
+// fPort 7: version, all settings in the order of read_settings(), config CRC
+extern const uint8_t codec_settings[];
+// fPort 8: status, applied commands, config CRC
+extern const uint8_t codec_config_ack[];
+// fPort 9: version, per time-of-day profile: start in minutes (2047 unused), tdc, msr_ms, confirmed uplink policy
+extern const uint8_t codec_profiles[];
+// fPort 222: busy events, busy lost, airtime of the rolling day in 100 ms,
+// link samples, -RSSI, SNR + 128, link margin + 128, TX power index,
+// LA66 parameter store hits, misses, clock drift ppm + 512, time synced,
+// charge in 10 uAh per phase: awake, sleep, boot, join, settle, fence positive,
+// fence negative, TX, RX, log
+extern const uint8_t codec_diagnostics[];
+// fPort 223: error, busy retries, resyncs, rejoins
+extern const uint8_t codec_error[];
+
+//! State of a bit writer, see codec_begin()
+typedef struct codec_writer
+{
+	char *hex;
+	uint8_t bytes;
+	uint8_t acc;
+	uint8_t used;
+} codec_writer;
+
+//! Starts writing a packed payload as hex text to hex
+void codec_begin(codec_writer *writer, char *hex);
+
+//! Returns value clamped to the maximum of a field of bits width
+uint32_t codec_clamp(uint32_t value, uint8_t bits);
+
+//! Appends the lowest bits of value, clamped to the field maximum
+void codec_put(codec_writer *writer, uint32_t value, uint8_t bits);
+
+//! Pads the last byte and terminates the hex text
+/*!
+@return amount of payload bytes
+*/
+uint8_t codec_end(codec_writer *writer);
+
+//! Packs values according to schema and writes them as hex text to hex
+/*!
+Values exceeding their field width are clamped to the field maximum.
+
+@return amount of payload bytes
+*/
+uint8_t codec_encode(char *hex, const uint8_t *schema, const uint32_t *values);
+
+#endif /* CODEC_H_ */
@@ -26,16 +26,32 @@
 #define LA66_COMMAND_TIMEOUT 10 // 10 seconds
 #define LA66_RX_TIMEOUT 10 // 10 seconds
 #define LA66_RX_CONF_TIMEOUT 60 // 60 seconds
+#define LA66_PING_TIMEOUT 1000 // 1 second in ms
+#define LA66_WAKEUP_RETRIES 3
+#define LA66_DEFAULT_BAUD 9600
+#define LA66_DEFAULT_RX1DL 1000 // RX1 delay in ms if the LA66 does not answer (LoRaWAN default)
+#define LA66_DEFAULT_RX2DL 2000 // RX2 delay in ms if the LA66 does not answer (LoRaWAN default)
+#define LA66_BAUD_COMMAND "AT+BAUDR=%lu\r\n"
+#define LA66_FRAME_OVERHEAD 13 // MHDR, FHDR, FPort and MIC in bytes
+#define LA66_DR_REFRESH_UPLINKS 16 // uplinks without downlink after which the cached DR is queried again (ADR backoff)
 #define AT_OK "OK"
 #define AT_ERROR "AT_ERROR"
 #define AT_PARAM_ERROR "AT_PARAM_ERROR"
 #define AT_BUSY_ERROR "AT_BUSY_ERROR"
 #define AT_NO_NET_JOINED "AT_NO_NET_JOINED"
 
+#define LA66_PARAM_DR 0x01
+#define LA66_PARAM_TIMESTAMP 0x02
+#define LA66_PARAM_RX1DL 0x04
+#define LA66_PARAM_RX2DL 0x08
+
 typedef char LA66_buffer[LA66_MAX_BUFF];
 
 extern void log_serial(const char *msg);
 extern void log_serial_P(const char *msg);
+extern uint32_t get_uptime();
+extern bool idle_until(bool (*ready)(), uint16_t ms);
+extern bool idle_tasks_until(bool (*ready)(), uint16_t ms);
 
 //=========
 // GLOBALS
@@ -52,6 +68,15 @@ typedef enum LA66_ReturnCode {
 	LA66_EOB = LA66_MAX_BUFF	  /**< Reached end of buffer passed to function */
 } LA66_ReturnCode;
 
+//! Parameters of the LA66 which are cached, see LA66_refreshParams()
+typedef struct LA66_Params {
+	uint8_t dr;
+	uint16_t rx1_dl;              /**< RX1 delay in ms */
+	uint16_t rx2_dl;              /**< RX2 delay in ms */
+	uint32_t timestamp;
+	uint32_t timestamp_uptime;    /**< uptime in s when timestamp was read */
+} LA66_Params;
+
 typedef enum LA66_Stage {
 	WAIT_FOR_OK,
 	WAIT_FOR_TX,
@@ -72,6 +97,56 @@ void LA66_reset();
 void LA66_activate();
 void LA66_deactivate();
 
+//! Puts the LA66 into its low power sleep mode
+/*!
+The LoRaWAN session (keys, frame counters) is retained, so no rejoin is needed after waking up.
+
+@return LA66_SUCCESS the LA66 acknowledged the command and is sleeping
+@return LA66_ERROR the LA66 did not acknowledge the command, it is still awake
+*/
+LA66_ReturnCode LA66_sleep();
+
+//! Wakes the LA66 from sleep mode
+/*!
+Any UART activity wakes the module, the first characters might be lost so it is
+polled with "AT" until it answers with "OK".
+
+@return LA66_SUCCESS the LA66 is awake and ready for commands
+@return LA66_ERROR the LA66 did not answer after LA66_WAKEUP_RETRIES attempts
+*/
+LA66_ReturnCode LA66_wakeup();
+
+//! Returns true if the LA66 has been put to sleep and not woken up since
+bool LA66_is_sleeping();
+
+//! Re-synchronizes the UART link to the LA66
+/*!
+Discards anything in the RX buffer, terminates a possibly half received command
+on the LA66 side and checks if the LA66 answers again.
+
+@return LA66_SUCCESS the LA66 answers commands again
+@return LA66_ERROR the LA66 does not answer, a reset is required
+*/
+LA66_ReturnCode LA66_resync();
+
+//! Switches the UART link to the LA66 to a different baud rate
+/*!
+First checks if the LA66 already runs at baud, as it keeps its baud rate across resets.
+If not the LA66 is switched from LA66_DEFAULT_BAUD to baud and the link is verified.
+If anything fails both sides are set back to LA66_DEFAULT_BAUD.
+
+@return the baud rate the link runs at afterwards
+*/
+uint32_t LA66_negotiate_baud(uint32_t baud);
+
+//! Write a command to the LA66 which is only answered with OK or an error
+/*!
+@return LA66_SUCCESS the LA66 answered with "OK"
+@return LA66_ERROR, LA66_ERR_PARAM, LA66_ERR_BUSY, LA66_ERR_JOIN the LA66 answered with the respective error
+@return LA66_ERR_PANIC no answer within LA66_COMMAND_TIMEOUT
+*/
+LA66_ReturnCode LA66_command_P(const char *command);
+
 
 //! Write a command to the LA66 and recieve it's response
 /*!
@@ -87,14 +162,53 @@ LA66_ReturnCode LA66_query_command_P(const char *command, char *response);
 
 //! Waits for the LA66 to join a LoRaWAN network
 /*!
+@param timeout seconds to wait, at most LA66_JOIN_TIMEOUT
+
 @return LA66_SUCCESS The device joined a LoRaWAN network and is ready to transmit data
 @return LA66_ERR_JOIN The device was not able to join a LoRaWAN network
 */
-LA66_ReturnCode LA66_waitForJoin(void (*led_toggle_func)(void));
+LA66_ReturnCode LA66_waitForJoin(void (*led_toggle_func)(void), uint16_t timeout);
 
+//! Returns the current DR
+/*!
+The DR is cached and only queried again after a reset, a received downlink
+(ADR commands), a rejected uplink or LA66_DR_REFRESH_UPLINKS uplinks (ADR backoff).
+*/
 uint8_t LA66_getDr();
+
+//! Reads DR and RX delays into the parameter store
+/*!
+Call after a join, afterwards the parameters are only queried again if
+an event like a reset or a downlink might have changed them.
+The timestamp is not read, it is only valid after a time sync (LA66_synctime()).
+*/
+void LA66_refreshParams();
+
+//! Gets and resets the hit and miss counters of the parameter store
+void LA66_getParamStats(uint16_t *hits, uint16_t *misses);
+
+//! Maximum application payload in bytes at dr (EU868)
+uint8_t LA66_getMaxPayload(uint8_t dr);
+//! Time on air in ms of an uplink with size bytes application payload at dr (EU868)
+/*!
+Includes the LoRaWAN frame overhead, assumes explicit header, coding rate 4/5 and 8 preamble symbols.
+*/
+uint16_t LA66_getAirtime(uint8_t dr, uint8_t size);
+//! How often the last LA66_transmitB() or LA66_synctime() went on air (txDone), 0 if not at all
+/*!
+The LA66 repeats a confirmed uplink until it is acknowledged, each repetition counts.
+*/
+uint8_t LA66_getTxCount();
+//! True while a transmission of the LA66 might be on air (join, uplink until txDone, pending repetition)
+bool LA66_isTransmitting();
+//! Counts the transmissions started, compare two values to find out if the LA66 transmitted in between
+uint8_t LA66_getTxSerial();
+//! RX1 delay in ms after txDone, cached, LA66_DEFAULT_RX1DL if the LA66 does not answer
 uint16_t LA66_getRx1Dl();
+//! RX2 delay in ms after txDone, cached, LA66_DEFAULT_RX2DL if the LA66 does not answer
 uint16_t LA66_getRx2Dl();
+
+//! Returns the network time in s, read once and then advanced by get_uptime()
 uint32_t LA66_getTimestamp();
 
 //! Sends a confirmed/unconfirmed frame with an application payload of buff.
@@ -110,6 +224,24 @@ Transmits data over a LoRa network in either confirmed or unconfirmed mode.
 */
 LA66_ReturnCode LA66_transmitB(uint8_t *fPort, const bool confirm, char *payload, uint8_t *rxSize);
 
+//! Gets RSSI (dBm) and SNR (dB) of the last received downlink
+/*!
+@return true if a downlink was received since the last call, false otherwise and rssi and snr are not set
+*/
+bool LA66_getLinkQuality(int16_t *rssi, int8_t *snr);
+
+//! SNR in dB a receiver needs to demodulate at dr (EU868)
+int8_t LA66_getRequiredSnr(uint8_t dr);
+
+//! Sets the TX power
+/*!
+@param index 0 is the maximum EIRP of 16 dBm, each step reduces it by 2 dB (EU868 0 - 7)
+
+@return LA66_SUCCESS the LA66 accepted the TX power
+@return LA66_ERR_PARAM invalid index
+*/
+LA66_ReturnCode LA66_setTxPower(uint8_t index);
+
 LA66_ReturnCode LA66_synctime();
 
 #endif /* LA66_H_ */
@@ -0,0 +1,30 @@
+/*!
+@file	power.h
+@brief	Power states of the peripherals, the GPIOs and the sleep modes.
+
+mcu_init() of Atmel START disables all peripherals and parks all pins,
+the drivers enable only what they use (TIMER2, USART0, USART1).
+The ADC, the LA66 lines and the sleep modes are switched here.
+*/
+
+#ifndef POWER_H_
+#define POWER_H_
+
+#include <atmel_start.h>
+
+//! Powers the ADC and the measurement circuit on or off
+void power_adc(const bool on);
+
+//! Parks the UART RX line of the LA66 while it is held in reset
+/*!
+The LA66 does not drive its TX line in reset, the pull-up keeps the input from floating.
+*/
+void power_radio(const bool on);
+
+//! Sleeps in the selected sleep mode until the next interrupt, BOD disabled
+void power_sleep();
+
+//! Turns all peripherals off and sleeps in power down mode forever
+void power_off();
+
+#endif /* POWER_H_ */
@@ -47,6 +47,8 @@ typedef void (*usart_cb_t)(void);
 
 int8_t USART_0_init();
 
+void USART_0_set_baud(const uint32_t baud);
+
 void USART_0_enable();
 
 void USART_0_enable_rx();
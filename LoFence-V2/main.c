@@ -1,8 +1,12 @@
 #include <atmel_start.h>
 #include <util/delay.h>
+#include <util/crc16.h>
+#include <util/atomic.h>
 #include <string.h>
 #include <stdio.h>
 #include "la66.h"
+#include "codec.h"
+#include "power.h"
 #include "variable_delay.h"
 #include "main.h"
 
@@ -16,9 +20,34 @@ uint16_t EEMEM bat_low = BATTERY_LOW_THRESHOLD;
 uint8_t EEMEM bat_low_count_max = BATTERY_LOW_MAX_CYCLES;
 uint16_t EEMEM bat_low_min = BATTERY_ABSOLUTE_MINIMUM;
 uint8_t EEMEM daily_confirmed_uplinks = DAILY_CONFIRMED_UPLINKS;
+uint32_t EEMEM la_baud = LA66_BAUD;
+uint16_t EEMEM rbe_fence_delta = RBE_FENCE_DELTA;
+uint16_t EEMEM rbe_bat_delta = RBE_BATTERY_DELTA;
+uint8_t EEMEM rbe_heartbeat = RBE_HEARTBEAT_CYCLES;
+uint16_t EEMEM alarm_volt = ALARM_VOLTAGE;
+uint16_t EEMEM alarm_interval = ALARM_CHECK_INTERVAL;
+uint8_t EEMEM alarm_confirm = ALARM_CONFIRM;
+uint16_t EEMEM msr_interval = MEASURE_INTERVAL;
+uint8_t EEMEM settings_legacy = SETTINGS_LEGACY;
+uint16_t EEMEM airtime_day = AIRTIME_DAY_BUDGET;
+uint8_t EEMEM link_adapt = LINK_ADAPT;
+int16_t EEMEM clock_drift = 0;
+profile EEMEM profiles[PROFILE_COUNT] = { [0 ... PROFILE_COUNT - 1] = { PROFILE_UNUSED, 0, 0, PROFILE_CONFIRM_DAILY } };
+uint8_t EEMEM settings_layout = SETTINGS_LAYOUT;
+uint32_t EEMEM tdc_min = TDC_MIN;
+uint32_t EEMEM tdc_max = TDC_MAX;
 
 volatile uint32_t day_seconds = 0;
 volatile uint32_t sleep_seconds = 0;
+volatile uint32_t uptime_seconds = 0;
+// crystal error in ppm, positive if the clock runs fast, accumulated each second
+volatile int16_t drift_ppm = 0;
+volatile int32_t drift_acc = 0;
+// length in s of the running TIMER2 period and sleep_seconds up to which long periods may run
+volatile uint8_t tick_period = 1;
+volatile uint32_t tick_until = 0;
+// seconds counted by TIMER2 without drift compensation, time base of idle_wait()
+volatile uint32_t timer_seconds = 0;
 
 volatile uint8_t adc_clear = 0;
 volatile uint8_t adc_max = 0;
@@ -33,6 +62,69 @@ uint16_t volt_bat = 0;
 uint16_t volt_fence_plus = 0;
 uint16_t volt_fence_minus = 0;
 
+// measurement parts and stages
+#define MSR_BATTERY 0x01
+#define MSR_FENCES 0x02
+
+#define MSR_IDLE 0
+#define MSR_SETTLE 1
+#define MSR_BATTERY_GND 2
+#define MSR_BATTERY_SAMPLE 3
+#define MSR_FENCE_PLUS 4
+#define MSR_FENCE_MINUS 5
+
+// measurement running in stages, each stage is a step of TASK_MEASURE
+uint8_t msr_stage = MSR_IDLE;
+uint8_t msr_parts = 0;
+// LA66_getTxSerial() when the battery sample window started
+uint8_t msr_tx_serial = 0;
+// a full measurement was taken in the background and not used yet
+bool msr_fresh = false;
+
+// energy accounting phases, the current of each is defined in main.h
+#define ENERGY_AWAKE 0
+#define ENERGY_SLEEP 1
+#define ENERGY_BOOT 2
+#define ENERGY_JOIN 3
+#define ENERGY_SETTLE 4
+#define ENERGY_FENCE_PLUS 5
+#define ENERGY_FENCE_MINUS 6
+#define ENERGY_TX 7
+#define ENERGY_RX 8
+#define ENERGY_LOG 9
+#define ENERGY_PHASES 10
+
+const uint16_t energy_current[ENERGY_PHASES] PROGMEM = { ENERGY_AWAKE_UA, ENERGY_SLEEP_UA, ENERGY_BOOT_UA, ENERGY_JOIN_UA,
+	ENERGY_SETTLE_UA, ENERGY_FENCE_UA, ENERGY_FENCE_UA, ENERGY_TX_UA, ENERGY_RX_UA, ENERGY_LOG_UA };
+
+// time spent in each phase since the last diagnostics uplink in 1/256 s
+uint32_t energy_ticks[ENERGY_PHASES];
+uint8_t energy_phase = ENERGY_BOOT;
+uint32_t energy_since = 0;
+
+uint16_t batch_fence_plus[BATCH_MAX_SAMPLES];
+uint16_t batch_fence_minus[BATCH_MAX_SAMPLES];
+uint8_t batch_count = 0;
+
+bool config_ack = false;
+uint8_t config_ack_status = 0;
+uint8_t config_ack_entries = 0;
+
+uint16_t sent_volt_bat = 0;
+uint16_t sent_volt_fence_plus = 0;
+uint16_t sent_volt_fence_minus = 0;
+uint8_t unreported_cycles = 0;
+
+bool fence_alarm = false;
+bool fence_alarm_reported = false;
+bool fence_alarm_sent = false;
+uint32_t fence_alarm_uptime = 0;
+// uptime of the last fence alarm state change, an alarm was detected since the start
+uint32_t fence_change_uptime = 0;
+bool fence_alarm_seen = false;
+uint16_t alarm_volt_fence_plus = 0;
+uint16_t alarm_volt_fence_minus = 0;
+
 uint8_t settings = 0;
 
 uint32_t daily_cycle_count = 0;
@@ -44,18 +136,100 @@ uint32_t bisect_cycle_seconds = 0;
 
 bool do_deactivate = false;
 
+bool joined = false;
+uint8_t join_attempts = 0;
+uint32_t join_backoff_seconds = 0;
+
+// cycles with failed transmissions in a row, counted once per cycle
+uint8_t failed_transmissions = 0;
+bool cycle_failed = false;
+uint8_t busy_retry_count = 0;
+uint8_t resync_count = 0;
+uint8_t rejoin_count = 0;
+
+bool diagnostics = false;
+uint16_t busy_events_daily = 0;
+uint8_t busy_lost_daily = 0;
+
+// airtime in ms per 10 minutes of the rolling hour and per hour of the rolling day
+uint16_t airtime_slots[6];
+uint16_t airtime_hours[24];
+uint32_t airtime_slot = 0;
+uint32_t cycle_airtime = 0;
+bool airtime_blocked = false;
+
+// link margin in 1/4 dB as rolling average of the downlink SNR above the demodulation floor
+int16_t link_margin = 0;
+bool link_valid = false;
+int16_t link_rssi = 0;
+int8_t link_snr = 0;
+uint8_t link_samples_daily = 0;
+uint8_t tx_power = 0;
+
+// network time of the last sync and the uptime it was taken at
+bool time_synced = false;
+bool time_align = false;
+uint32_t sync_timestamp = 0;
+uint32_t sync_uptime = 0;
+uint32_t sync_interval = TIME_SYNC_MIN_INTERVAL;
+uint32_t sync_attempt_uptime = 0;
+
+// moves the own transmit slot after a detected collision, see get_slot_wait()
+uint8_t slot_rotation = 0;
+
+uint32_t radio_wakeup_day_seconds = 0;
+
+// time-of-day profile active in the current cycle, -1 if none
+int8_t active_profile = -1;
+
 // ----------------------------------------------------------------------------------------------
 
 ISR(TIMER2_OVF_vect)
 {
+	uint8_t ticks = tick_period;
+	
+	// the prescaler is switched right after the overflow so the next period has the full length,
+	// long periods only while a sleep is running, 1 s periods keep the sub-second resolution otherwise
+	tick_period = sleep_seconds + ticks + TICK_LONG <= tick_until ? TICK_LONG : 1;
+	
 	// see https://www.mikrocontroller.net/articles/AVR-GCC-Tutorial/Die_Timer_und_Z%C3%A4hler_des_AVR#Timer2_im_Asynchron_Mode
-	TCCR2B = TCCR2B;
-	day_seconds++;
-	sleep_seconds++;
+	if (tick_period == TICK_LONG)
+	{
+		TCCR2B = (1 << CS22) | (1 << CS21) | (1 << CS20);
+	}
+	else
+	{
+		TCCR2B = (1 << CS22) | (0 << CS21) | (1 << CS20);
+	}
+	
+	timer_seconds += ticks;
+	
+	// drift compensation, drop or add a second whenever the error sums up to one
+	drift_acc += (int32_t)drift_ppm * ticks;
+	
+	if (drift_acc >= 1000000L)
+	{
+		drift_acc -= 1000000L;
+		ticks--;
+	}
+	else if (drift_acc <= -1000000L)
+	{
+		drift_acc += 1000000L;
+		ticks++;
+	}
+	
+	day_seconds += ticks;
+	sleep_seconds += ticks;
+	uptime_seconds += ticks;
 	LED_CLK_toggle_level();
 	while (ASSR & ((1 << TCN2UB) | (1 << OCR2AUB) | (1 << OCR2BUB) | (1 << TCR2AUB) | (1 << TCR2BUB)));
 }
 
+// Only wakes the CPU at the end of an idle_wait().
+ISR(TIMER2_COMPA_vect)
+{
+}
+
 ISR(ADC_vect)
 {
 	adc_val = ADCH;
@@ -71,19 +245,281 @@ ISR(ADC_vect)
 
 // ----------------------------------------------------------------------------------------------
 
-void power_save(uint32_t sec)
+bool check_fence();
+bool get_alarm_due();
+void set_tx_power(uint8_t index);
+void measure_step();
+void measure_finish();
+
+// Cooperative tasks, stackless state machines run by idle_tasks_until() while the MCU waits.
+// run() does one step and schedules the next one with task_schedule(), a task which does
+// not schedule itself again is stopped. The MCU sleeps while no task is due.
+typedef struct task
+{
+	void (*run)();
+	uint32_t due; // get_ticks() at which run() is called
+	bool active;
+} task;
+
+#define TASK_MEASURE 0
+#define TASK_COUNT 1
+
+task tasks[TASK_COUNT] = { { measure_step, 0, false } };
+
+// Returns the time in 1/256 s counted by TIMER2, in TICK_LONG periods the resolution is TICK_LONG / 256 s.
+uint32_t get_ticks()
+{
+	uint32_t seconds;
+	uint8_t count;
+	uint8_t period;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		seconds = timer_seconds;
+		count = TCNT2;
+		period = tick_period;
+		
+		// the counter already overflowed but the ISR did not run yet
+		if ((TIFR2 & (1 << TOV2)) && count < 0x80)
+		{
+			seconds += period;
+		}
+	}
+	
+	return (seconds << 8) + (uint32_t)count * period;
+}
+
+// Accounts the time since the last phase change to the running phase and enters phase.
+// Returns the previous phase to return to.
+uint8_t energy_enter(uint8_t phase)
+{
+	uint32_t now = get_ticks();
+	uint8_t previous = energy_phase;
+	
+	energy_ticks[energy_phase] += now - energy_since;
+	energy_since = now;
+	energy_phase = phase;
+	
+	return previous;
+}
+
+// Moves ms milliseconds accounted to phase from to phase to.
+void energy_shift(uint8_t from, uint8_t to, uint16_t ms)
+{
+	uint32_t ticks = MIN(((uint32_t)ms * 256) / 1000, energy_ticks[from]);
+	
+	energy_ticks[from] -= ticks;
+	energy_ticks[to] += ticks;
+}
+
+// Returns the charge used in phase in 10 uAh.
+uint32_t get_energy_charge(uint8_t phase)
+{
+	return (energy_ticks[phase] >> 8) * (pgm_read_word(&energy_current[phase]) / 10) / 3600;
+}
+
+// Returns get_ticks() in ms milliseconds, rounded up.
+uint32_t get_ticks_after(uint16_t ms)
+{
+	// in long periods the time is up to one count ahead of the ticks
+	return get_ticks() + tick_period - 1 + ((uint32_t)ms * 256 + 999) / 1000;
+}
+
+// Schedules the next step of task id in ms milliseconds.
+void task_schedule(uint8_t id, uint16_t ms)
+{
+	tasks[id].due = get_ticks_after(ms);
+	tasks[id].active = true;
+}
+
+// Runs the steps of all tasks which are due.
+void tasks_run()
+{
+	for (uint8_t i = 0; i < TASK_COUNT; i++)
+	{
+		while (tasks[i].active && (int32_t)(get_ticks() - tasks[i].due) >= 0)
+		{
+			tasks[i].active = false;
+			tasks[i].run();
+		}
+	}
+}
+
+// Lowers left to the ticks from now until the next task is due.
+void tasks_next(uint32_t now, int32_t *left)
+{
+	for (uint8_t i = 0; i < TASK_COUNT; i++)
+	{
+		if (tasks[i].active && (int32_t)(tasks[i].due - now) < *left)
+		{
+			*left = tasks[i].due - now;
+		}
+	}
+}
+
+// Waits up to ms milliseconds or until ready returns true, ready may be NULL.
+// The CPU sleeps in idle mode in between, any interrupt (USART RX, ADC, TIMER2) wakes it
+// to check ready again and TIMER2 compare A ends the wait with a resolution of 1/256 s,
+// TICK_LONG / 256 s in long timer periods. Due tasks run meanwhile if run_tasks is set.
+// Returns true if ready returned true.
+bool idle_wait(bool (*ready)(), uint16_t ms, bool run_tasks)
+{
+	uint32_t end = get_ticks_after(ms);
+	
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	TIMSK2 |= (1 << OCIE2A);
+	
+	while (!(ready && ready()))
+	{
+		if (run_tasks)
+		{
+			tasks_run();
+		}
+		
+		uint32_t now = get_ticks();
+		int32_t left = end - now;
+		
+		if (left <= 0)
+		{
+			break;
+		}
+		
+		if (run_tasks)
+		{
+			tasks_next(now, &left);
+		}
+		
+		// compare value in counts of the running timer period, the overflow wakes up anyway
+		uint32_t start;
+		uint8_t period;
+		bool overflow;
+		
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			start = timer_seconds << 8;
+			period = tick_period;
+			overflow = TIFR2 & (1 << TOV2);
+		}
+		
+		// a new period started since now was read or its ISR runs right after the atomic block
+		if (overflow || (int32_t)(now - start) < 0 || now - start >= (uint32_t)period << 8)
+		{
+			continue;
+		}
+		
+		uint32_t count = (now + left - start + period - 1) / period;
+		uint8_t current = (now - start) / period;
+		
+		// the compare match needs two counts to be set in time, in 1 s periods the rest is
+		// polled, long periods wake up to one count late instead
+		if (count < (uint32_t)current + 2)
+		{
+			if (period == 1)
+			{
+				continue;
+			}
+			
+			count = current + 2;
+		}
+		
+		OCR2A = count & 0xFF;
+		while (ASSR & (1 << OCR2AUB));
+		TIFR2 = (1 << OCF2A);
+		
+		// sleep right after enabling interrupts so no wakeup is missed
+		cli();
+		if (!(ready && ready()))
+		{
+			sleep_enable();
+			sei();
+			sleep_cpu();
+			sleep_disable();
+		}
+		sei();
+	}
+	
+	TIMSK2 &= ~(1 << OCIE2A);
+	set_sleep_mode(SLEEP_MODE_PWR_SAVE);
+	
+	return ready && ready();
+}
+
+// Waits without running tasks, for waits deep in the call stack like the UART reads of the LA66 driver.
+bool idle_until(bool (*ready)(), uint16_t ms)
+{
+	return idle_wait(ready, ms, false);
+}
+
+// Waits and runs due tasks meanwhile, only for waits on a shallow stack: the main loop and
+// the transaction loops of the LA66 driver, the task steps then use the stack on top of them.
+bool idle_tasks_until(bool (*ready)(), uint16_t ms)
+{
+	return idle_wait(ready, ms, true);
+}
+
+void idle_ms(uint16_t ms)
+{
+	idle_tasks_until(NULL, ms);
+}
+
+// Sets the sleep_seconds up to which the timer may run in long periods.
+void set_tick_until(uint32_t until)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		tick_until = until;
+	}
+}
+
+// Sleeps for sec seconds, checks the fence every alarm_interval seconds if enabled.
+// Returns true early if an alarm or recovery uplink is due.
+// The timer runs in TICK_LONG periods as long as they end before the next check or the end of the sleep.
+bool power_save(uint32_t sec)
 {
-	sleep_seconds = 0;
-	sleep_enable();
+	bool monitor = eeprom_read_word(&alarm_volt) > 0;
+	uint16_t interval = eeprom_read_word(&alarm_interval);
+	uint32_t next_check = interval;
+	
+	// the ADC stops while sleeping
+	measure_finish();
+	
+	uint8_t phase = energy_enter(ENERGY_SLEEP);
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		sleep_seconds = 0;
+		tick_until = monitor ? MIN(sec + 1, next_check) : sec + 1;
+	}
+	
 	while (sleep_seconds <= sec)
 	{
-		sleep_mode();
+		power_sleep();
+		
+		if (monitor && sleep_seconds >= next_check)
+		{
+			check_fence();
+			
+			if (get_alarm_due())
+			{
+				set_tick_until(0);
+				energy_enter(phase);
+				return true;
+			}
+			
+			next_check = sleep_seconds + interval;
+			set_tick_until(MIN(sec + 1, next_check));
+		}
 	}
-	sleep_disable();
+	set_tick_until(0);
+	energy_enter(phase);
+	
+	return false;
 }
 
 void log_serial(const char *msg)
 {
+	uint8_t phase = energy_enter(ENERGY_LOG);
+	
 	for (uint8_t i = 0; i < strlen(msg); i++)
 	{
 		while (!USART_1_is_tx_ready())
@@ -94,10 +530,14 @@ void log_serial(const char *msg)
 	while (USART_1_is_tx_busy())
 	{
 	}
+	
+	energy_enter(phase);
 }
 
 void log_serial_P(const char *msg)
 {
+	uint8_t phase = energy_enter(ENERGY_LOG);
+	
 	for (uint8_t i = 0; i < strlen_P(msg); i++)
 	{
 		while (!USART_1_is_tx_ready())
@@ -108,6 +548,20 @@ void log_serial_P(const char *msg)
 	while (USART_1_is_tx_busy())
 	{
 	}
+	
+	energy_enter(phase);
+}
+
+uint32_t get_uptime()
+{
+	uint32_t uptime;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		uptime = uptime_seconds;
+	}
+	
+	return uptime;
 }
 
 // ----------------------------------------------------------------------------------------------
@@ -148,281 +602,1069 @@ void adc_init()
 	LED_MSR_set_level(false);
 }
 
-void measure()
-{
-	LED_MSR_set_level(true);
-
-	log_serial_P(PSTR("Measuring...\r\n"));
-
-	// ----------------------------------------------------------------------------------------------
-
-	PRR0 &= ~(1 << PRADC); // Enable ADC
-	ADC_POWER_set_level(true);
-	_delay_ms(1000);
-
-	// ----------------------------------------------------------------------------------------------
-
-	log_serial_P(PSTR("Measuring battery: "));
-
-	BAT_GND_set_level(false);
-	_delay_ms(1000);
-
-	ADMUX = (ADMUX & 0xE0) | (1 << MUX2); // Pin 4
-	ADCSRA |= (1 << ADEN);
-	ADCSRA |= (1 << ADSC);
-	adc_clear = 1;
-	_delay_ms(500);
-	ADCSRA &= ~(1 << ADEN);
-	BAT_GND_set_level(true);
-
-	volt_bat = (((330000 / 255 * adc_min * 2) - 0)) / 100 + 125;
-	// 125mV is the measured voltage dfrop of the Schottky diode
-
-	snprintf_P(buffer_info, sizeof(buffer_info), PSTR("%d mV\r\n"), volt_bat);
-	log_serial(buffer_info);
-
-	// ----------------------------------------------------------------------------------------------
+#define FENCE_PLUS (1 << MUX1) // Pin 2
+#define FENCE_MINUS 0 // Pin 0
 
-	log_serial_P(PSTR("Measuring fence positive: "));
+void measure_done();
 
-	ADMUX = (ADMUX & 0xE0) | (1 << MUX1); // Pin 2
+// Starts sampling the fence pole (ADC mux) for its maximum,
+// the ADC must be enabled and powered.
+void fence_start(uint8_t pole)
+{
+	ADMUX = (ADMUX & 0xE0) | pole;
 	ADCSRA |= (1 << ADEN);
 	ADCSRA |= (1 << ADSC);
 	adc_clear = 1;
-	_delay_100ms(eeprom_read_word(&msr_ms));
-	ADCSRA &= ~(1 << ADEN);
-
-	volt_fence_plus = (eeprom_read_word(&max_volt) / 255 * adc_max);
-	
-	snprintf_P(buffer_info, sizeof(buffer_info), PSTR("%d V\r\n"), volt_fence_plus);
-	log_serial(buffer_info);
-
-	// ----------------------------------------------------------------------------------------------
-
-	log_serial_P(PSTR("Measuring fence negative: "));
+}
 
-	ADMUX = (ADMUX & 0xE0); // Pin 0
-	ADCSRA |= (1 << ADEN);
-	ADCSRA |= (1 << ADSC);
-	adc_clear = 1;
-	_delay_100ms(eeprom_read_word(&msr_ms));
+// Stops sampling and returns the maximum fence voltage.
+uint16_t fence_stop()
+{
 	ADCSRA &= ~(1 << ADEN);
 
-	volt_fence_minus = (eeprom_read_word(&max_volt) / 255 * adc_max);
-
-	snprintf_P(buffer_info, sizeof(buffer_info), PSTR("%d V\r\n"), volt_fence_minus);
-	log_serial(buffer_info);
-
-	// ----------------------------------------------------------------------------------------------
-
-	ADC_POWER_set_level(false);
-	PRR0 |= (1 << PRADC); // Disable ADC
-
-	LED_MSR_set_level(false);
+	return eeprom_read_word(&max_volt) / 255 * adc_max;
 }
 
-void reset_join()
-{	
-	log_serial_P(PSTR("Resetting LA66 module...\r\n"));
-	LA66_reset();
+// Returns the maximum fence voltage of pole (ADC mux) within ms,
+// the ADC must be enabled and powered.
+uint16_t measure_fence(uint8_t pole, uint16_t ms)
+{
+	uint8_t phase = energy_enter(pole == FENCE_PLUS ? ENERGY_FENCE_PLUS : ENERGY_FENCE_MINUS);
+	
+	fence_start(pole);
+	idle_ms(ms);
+	
+	energy_enter(phase);
 
-	LED_TX_set_level(true);
+	return fence_stop();
+}
 
-	log_serial_P(PSTR("Waiting to join network...\r\n"));
-	if (LA66_waitForJoin(LED_TX_toggle_level) == LA66_ERR_JOIN)
+// Appends the current fence values to the batch, drops the oldest sample if full.
+void batch_add()
+{
+	if (batch_count == BATCH_MAX_SAMPLES)
 	{
-		LA66_deactivate();
-
-		while (1)
-		{
-			LED_TX_toggle_level();
-			_delay_ms(100);
-		}
+		memmove(&batch_fence_plus[0], &batch_fence_plus[1], sizeof(batch_fence_plus[0]) * (BATCH_MAX_SAMPLES - 1));
+		memmove(&batch_fence_minus[0], &batch_fence_minus[1], sizeof(batch_fence_minus[0]) * (BATCH_MAX_SAMPLES - 1));
+		batch_count--;
 	}
 	
-	LED_TX_set_level(false);
+	batch_fence_plus[batch_count] = volt_fence_plus / CODEC_FENCE_STEP;
+	batch_fence_minus[batch_count] = volt_fence_minus / CODEC_FENCE_STEP;
+	batch_count++;
 }
 
-void handle_downlink(uint8_t *rxSize)
+// Returns the index of the time-of-day profile active now or -1 if none is,
+// the profiles only apply once day_seconds is aligned to the network time.
+int8_t get_profile()
 {
-	log_serial_P(PSTR("Downlink received...\r\n"));
-
-	switch (buffer_la[0] & 0xFF)
+	int8_t active = -1;
+	int8_t last = -1;
+	uint16_t active_start = 0;
+	uint16_t last_start = 0;
+	uint16_t minute = day_seconds / 60;
+	
+	if (!time_synced)
 	{
-		case 0x01: // transmit duty cycle
+		return -1;
+	}
+	
+	for (uint8_t i = 0; i < PROFILE_COUNT; i++)
+	{
+		uint16_t start = eeprom_read_word(&profiles[i].start);
+		
+		if (start >= 1440)
 		{
-			if (*rxSize == 4)
-			{
-				uint32_t value = ((uint32_t)buffer_la[1] << 16 | buffer_la[2] << 8 | buffer_la[3]);
-				
-				if (value == 0)
-				{
-					value = INTERVAL_SECONDS;
-				}
-				
-				eeprom_write_dword(&tdc, value);
-			}
-			break;
+			continue;
 		}
-		case 0x04: // reset LA66
+		
+		if (start <= minute && (active < 0 || start >= active_start))
 		{
-			if (*rxSize == 1)
-			{
-				reset_join();
-			}
-			break;
+			active = i;
+			active_start = start;
 		}
-		case 0x10: // daily confirmed uplinks
+		
+		if (last < 0 || start >= last_start)
 		{
-			if (*rxSize == 2)
-			{
-				uint8_t value = buffer_la[1];
-				
-				eeprom_write_byte(&daily_confirmed_uplinks, value);
-				
-				daily_confirmed_uplink_count = 0;
-			}
-			break;
+			last = i;
+			last_start = start;
 		}
-		case 0x20: // maximum fence voltage at ADC max, this depends on actual resistor values
+	}
+	
+	// before the first profile of the day the last one of the previous day still applies
+	return active >= 0 ? active : last;
+}
+
+// Returns the seconds until the next time-of-day profile starts, 0 if no other profile follows.
+uint32_t get_profile_left()
+{
+	int8_t next = -1;
+	uint32_t next_left = 0;
+	
+	if (active_profile < 0)
+	{
+		return 0;
+	}
+	
+	for (uint8_t i = 0; i < PROFILE_COUNT; i++)
+	{
+		uint32_t start = eeprom_read_word(&profiles[i].start);
+		
+		if (start >= 1440 || i == active_profile)
 		{
-			if (*rxSize == 3)
-			{
-				eeprom_write_word(&max_volt, (buffer_la[1] << 8 | buffer_la[2]));
-			}
-			break;
+			continue;
 		}
-		case 0x21: // measurement delay for each pole
+		
+		start *= 60;
+		
+		uint32_t left = start > day_seconds ? start - day_seconds : start + 86400 - day_seconds;
+		
+		if (next < 0 || left < next_left)
 		{
-			if (*rxSize == 3)
-			{
-				uint16_t value = (buffer_la[1] << 8 | buffer_la[2]);
-				
-				if (value == 0)
-				{
-					value = MEASURE_MS;
-				}
-				
-				eeprom_write_word(&msr_ms, value);
-			}
-			break;
+			next = i;
+			next_left = left;
 		}
-		case 0x30: // battery low voltage
+	}
+	
+	return next_left;
+}
+
+// Returns the tdc of the active time-of-day profile or the tdc setting.
+uint32_t get_profile_tdc()
+{
+	uint32_t value = active_profile >= 0 ? eeprom_read_dword(&profiles[active_profile].tdc) : 0;
+	
+	return value > 0 ? value : eeprom_read_dword(&tdc);
+}
+
+// Returns the measurement time per pole of the active time-of-day profile or the msr_ms setting.
+uint16_t get_msr_ms()
+{
+	uint16_t value = active_profile >= 0 ? eeprom_read_word(&profiles[active_profile].msr_ms) : 0;
+	
+	return value > 0 ? value : eeprom_read_word(&msr_ms);
+}
+
+// Switches to the time-of-day profile active now, called at the start of each cycle.
+void update_profile()
+{
+	int8_t profile = get_profile();
+	
+	if (profile == active_profile)
+	{
+		return;
+	}
+	
+	active_profile = profile;
+	
+	if (profile >= 0)
+	{
+		snprintf_P(buffer_info, sizeof(buffer_info), PSTR("Time-of-day profile %d active\r\n"), profile);
+		log_serial(buffer_info);
+	}
+	else
+	{
+		log_serial_P(PSTR("No time-of-day profile active\r\n"));
+	}
+}
+
+// Lets the running measurement stage last ms milliseconds.
+void measure_wait(uint8_t stage, uint16_t ms)
+{
+	msr_stage = stage;
+	task_schedule(TASK_MEASURE, ms);
+}
+
+// Starts a measurement of parts (MSR_BATTERY, MSR_FENCES) which runs in stages
+// while the MCU waits (TASK_MEASURE), see measure_finish().
+void measure_start(uint8_t parts)
+{
+	LED_MSR_set_level(true);
+	
+	log_serial_P(PSTR("Measuring...\r\n"));
+	
+	msr_parts = parts;
+	
+	power_adc(true);
+	measure_wait(MSR_SETTLE, 1000);
+}
+
+// Ends the running measurement stage and starts the next one, the step of TASK_MEASURE.
+void measure_step()
+{
+	switch (msr_stage)
+	{
+		case MSR_SETTLE:
 		{
-			if (*rxSize == 3)
+			if (msr_parts & MSR_BATTERY)
+			{
+				BAT_GND_set_level(false);
+				measure_wait(MSR_BATTERY_GND, 1000);
+			}
+			else
 			{
-				eeprom_write_word(&bat_low, (buffer_la[1] << 8 | buffer_la[2]));
+				fence_start(FENCE_PLUS);
+				measure_wait(MSR_FENCE_PLUS, get_msr_ms());
 			}
+			
 			break;
 		}
-		case 0x31: // battery low cycle count
+		
+		case MSR_BATTERY_GND:
 		{
-			if (*rxSize == 2)
+			// the battery voltage sags while the LA66 transmits
+			if (LA66_isTransmitting())
 			{
-				eeprom_write_byte(&bat_low_count_max, buffer_la[1]);
+				measure_wait(MSR_BATTERY_GND, 100);
+				break;
 			}
+			
+			msr_tx_serial = LA66_getTxSerial();
+			ADMUX = (ADMUX & 0xE0) | (1 << MUX2); // Pin 4
+			ADCSRA |= (1 << ADEN);
+			ADCSRA |= (1 << ADSC);
+			adc_clear = 1;
+			measure_wait(MSR_BATTERY_SAMPLE, 500);
+			
 			break;
 		}
-		case 0x32: // battery low minimum voltage
+		
+		case MSR_BATTERY_SAMPLE:
 		{
-			if (*rxSize == 3)
+			ADCSRA &= ~(1 << ADEN);
+			
+			if (LA66_isTransmitting() || msr_tx_serial != LA66_getTxSerial())
+			{
+				log_serial_P(PSTR("Battery sample overlapped a transmission, repeating...\r\n"));
+				measure_wait(MSR_BATTERY_GND, 0);
+				break;
+			}
+			
+			BAT_GND_set_level(true);
+			
+			volt_bat = (((330000 / 255 * adc_min * 2) - 0)) / 100 + 125;
+			// 125mV is the measured voltage dfrop of the Schottky diode
+			
+			snprintf_P(buffer_info, sizeof(buffer_info), PSTR("Battery: %d mV\r\n"), volt_bat);
+			log_serial(buffer_info);
+			
+			if (msr_parts & MSR_FENCES)
+			{
+				fence_start(FENCE_PLUS);
+				measure_wait(MSR_FENCE_PLUS, get_msr_ms());
+			}
+			else
 			{
-				eeprom_write_word(&bat_low_min, (buffer_la[1] << 8 | buffer_la[2]));
+				measure_done();
 			}
+			
 			break;
 		}
-		case 0xFF: // transmit settings next cycle
+		
+		case MSR_FENCE_PLUS:
 		{
-			if (*rxSize == 2)
-			{
-				settings = buffer_la[1];
-				
-				if (settings > 0 && settings <= 3)
-				{
-					if (eeprom_read_dword(&tdc) >= 60)
-					{
-						// see handle_daily_settings() comment for this equal assignement
-						bisect_pause_count = 3;
-					}
-				}
-				// discard out of range commands
-				else if (settings > 3)
-				{
-					settings = 0;
-				}
-				
-			}
+			volt_fence_plus = fence_stop();
+			
+			snprintf_P(buffer_info, sizeof(buffer_info), PSTR("Fence positive: %d V\r\n"), volt_fence_plus);
+			log_serial(buffer_info);
+			
+			fence_start(FENCE_MINUS);
+			measure_wait(MSR_FENCE_MINUS, get_msr_ms());
+			
+			break;
+		}
+		
+		case MSR_FENCE_MINUS:
+		{
+			volt_fence_minus = fence_stop();
+			
+			snprintf_P(buffer_info, sizeof(buffer_info), PSTR("Fence negative: %d V\r\n"), volt_fence_minus);
+			log_serial(buffer_info);
+			
+			measure_done();
+			
 			break;
 		}
 	}
 }
 
-void handle_error(LA66_ReturnCode ret)
+// Sets the fence alarm state and remembers when it changed for the adaptive tdc.
+void set_fence_alarm(const bool alarm)
 {
-	switch (ret)
+	if (alarm == fence_alarm)
 	{
-		case LA66_SUCCESS:
-		case LA66_NODOWN:
+		return;
+	}
+	
+	fence_alarm = alarm;
+	fence_change_uptime = uptime_seconds;
+	
+	if (alarm)
+	{
+		fence_alarm_seen = true;
+	}
+}
+
+// Powers the measurement circuit off and evaluates the fence values.
+void measure_done()
+{
+	msr_stage = MSR_IDLE;
+	
+	power_adc(false);
+	
+	if (msr_parts & MSR_FENCES)
+	{
+		uint16_t _alarm_volt = eeprom_read_word(&alarm_volt);
+		
+		if (_alarm_volt > 0)
 		{
-			break;
+			set_fence_alarm(MAX(volt_fence_plus, volt_fence_minus) < _alarm_volt);
 		}
 		
-		case LA66_ERR_PANIC:
-		case LA66_ERROR:
-		case LA66_ERR_PARAM:
-		case LA66_ERR_JOIN:
-		case LA66_ERR_BUSY:
-		case LA66_EOB:
+		if (eeprom_read_word(&msr_interval) > 0)
 		{
-			last_error = ret;
-			break;
+			batch_add();
+		}
+		
+		if (msr_parts & MSR_BATTERY)
+		{
+			msr_fresh = true;
 		}
 	}
+
+	LED_MSR_set_level(false);
 }
 
-void transmit_data(const bool confirm)
+// Waits for the running measurement to complete.
+void measure_finish()
 {
-	LED_TX_set_level(true);
+	uint8_t phase = energy_phase;
+	
+	while (msr_stage != MSR_IDLE)
+	{
+		int32_t left = tasks[TASK_MEASURE].due - get_ticks();
+		
+		if (msr_stage == MSR_FENCE_PLUS)
+		{
+			energy_enter(ENERGY_FENCE_PLUS);
+		}
+		else if (msr_stage == MSR_FENCE_MINUS)
+		{
+			energy_enter(ENERGY_FENCE_MINUS);
+		}
+		else
+		{
+			energy_enter(ENERGY_SETTLE);
+		}
+		
+		if (left > 0)
+		{
+			idle_ms((uint32_t)left * 1000 / 256 + 1);
+		}
+		
+		tasks_run();
+	}
+	
+	energy_enter(phase);
+}
 
-	uint8_t fPort = 1;
-	uint8_t rxSize = 0;
+// Measures battery and fences, uses a full measurement
+// taken in the background if there is one.
+void measure()
+{
+	measure_finish();
+	
+	if (!msr_fresh)
+	{
+		measure_start(MSR_BATTERY | MSR_FENCES);
+		measure_finish();
+	}
+	
+	msr_fresh = false;
+}
 
-	if (confirm)
+// Short fence check while sleeping, only samples the negative pole if the positive is low.
+// Returns true if the alarm state changed.
+bool check_fence()
+{
+	uint16_t _alarm_volt = eeprom_read_word(&alarm_volt);
+	bool alarm = false;
+	
+	uint8_t phase = energy_enter(ENERGY_SETTLE);
+	
+	power_adc(true);
+	idle_ms(ALARM_SETTLE_MS);
+	
+	alarm_volt_fence_plus = measure_fence(FENCE_PLUS, ALARM_SAMPLE_MS);
+	
+	// the negative pole is only measured if the positive one has no pulse
+	alarm_volt_fence_minus = 0;
+	
+	if (alarm_volt_fence_plus < _alarm_volt)
 	{
-		log_serial_P(PSTR("Transmitting data confirmed...\r\n"));
+		alarm_volt_fence_minus = measure_fence(FENCE_MINUS, ALARM_SAMPLE_MS);
+		alarm = alarm_volt_fence_minus < _alarm_volt;
 	}
-	else
+	
+	power_adc(false);
+	energy_enter(phase);
+	
+	if (alarm == fence_alarm)
 	{
-		log_serial_P(PSTR("Transmitting data...\r\n"));
+		return false;
 	}
+	
+	set_fence_alarm(alarm);
+	
+	return true;
+}
 
-	if (daily_cycle_count == 1)
+// Switches the link to the LA66 to baud, returns the baud rate it runs at afterwards
+uint32_t negotiate_baud(uint32_t baud)
+{
+	baud = LA66_negotiate_baud(baud);
+	
+	snprintf_P(buffer_info, sizeof(buffer_info), PSTR("LA66 baud rate: %lu\r\n"), baud);
+	log_serial(buffer_info);
+	
+	return baud;
+}
+
+void reset_join()
+{	
+	energy_enter(ENERGY_JOIN);
+	
+	log_serial_P(PSTR("Resetting LA66 module...\r\n"));
+	power_radio(true);
+	LA66_reset();
+	
+	radio_wakeup_day_seconds = day_seconds;
+	
+	negotiate_baud(eeprom_read_dword(&la_baud));
+
+	LED_TX_set_level(true);
+
+	log_serial_P(PSTR("Waiting to join network...\r\n"));
+	if (LA66_waitForJoin(LED_TX_toggle_level, JOIN_ATTEMPT_TIMEOUT) == LA66_SUCCESS)
 	{
-		snprintf_P(buffer_la, sizeof(buffer_la), PSTR("%04X%04X%04X%02X"), volt_bat, volt_fence_plus, volt_fence_minus, VERSION);
+		joined = true;
+		join_attempts = 0;
+		join_backoff_seconds = 0;
+		
+		// start at full TX power, the link margin is unknown after a join
+		link_valid = false;
+		tx_power = 0;
+		
+		if (eeprom_read_byte(&link_adapt) > 0)
+		{
+			LA66_setTxPower(0);
+		}
+		
+		// read once, later only refreshed if changed by the network
+		LA66_refreshParams();
 	}
 	else
 	{
-		snprintf_P(buffer_la, sizeof(buffer_la), PSTR("%04X%04X%04X"), volt_bat, volt_fence_plus, volt_fence_minus);
+		// keep the LA66 in reset until the next attempt, the fence is still monitored meanwhile
+		LA66_deactivate();
+		power_radio(false);
+		
+		joined = false;
+		
+		uint32_t backoff = (uint32_t)JOIN_BACKOFF_BASE << MIN(join_attempts, 8);
+		
+		backoff = MIN(backoff, JOIN_BACKOFF_MAX);
+		backoff = backoff - backoff / 4 + (rand() % (backoff / 2 + 1));
+		
+		if (join_attempts < 0xFF) join_attempts++;
+		join_backoff_seconds = backoff;
+		
+		snprintf_P(buffer_info, sizeof(buffer_info), PSTR("Join attempt %u failed, next attempt in %lu seconds\r\n"), join_attempts, backoff);
+		log_serial(buffer_info);
+	}
+	
+	LED_TX_set_level(false);
+	
+	energy_enter(ENERGY_AWAKE);
+}
+
+void radio_wakeup()
+{
+	if (!LA66_is_sleeping())
+	{
+		return;
+	}
+	
+	log_serial_P(PSTR("Waking up LA66...\r\n"));
+	
+	radio_wakeup_day_seconds = day_seconds;
+	
+	LA66_ReturnCode ret = LA66_wakeup();
+	
+	if (ret != LA66_SUCCESS)
+	{
+		log_serial_P(PSTR("LA66 did not wake up!\r\n"));
+		
+		last_error = ret;
 	}
+}
 
-	LA66_ReturnCode ret = LA66_transmitB(&fPort, confirm, buffer_la, &rxSize);
+void radio_sleep()
+{
+	uint32_t awake = day_seconds >= radio_wakeup_day_seconds ? day_seconds - radio_wakeup_day_seconds : day_seconds;
 	
-	switch (ret)
+	if (LA66_sleep() != LA66_SUCCESS)
 	{
-		case LA66_SUCCESS:
+		log_serial_P(PSTR("LA66 did not enter sleep mode!\r\n"));
+	}
+	
+	// the time the LA66 is awake during the next cycle is accounted then
+	radio_wakeup_day_seconds = day_seconds;
+	
+	snprintf_P(buffer_info, sizeof(buffer_info), PSTR("LA66 awake for %lu seconds\r\n"), awake);
+	log_serial(buffer_info);
+}
+
+// Validates a single downlink command of type with size bytes of data,
+// the command is only applied if apply is set.
+bool handle_command(uint8_t type, const char *data, uint8_t size, bool apply)
+{
+	switch (type)
+	{
+		case 0x01: // transmit duty cycle
 		{
-			handle_downlink(&rxSize);
-			LED_TX_set_level(false);
+			if (size != 3)
+			{
+				return false;
+			}
+			
+			uint32_t value = ((uint32_t)data[0] << 16 | data[1] << 8 | data[2]);
+			
+			if (value > 0 && value < TDC_LOWEST)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				if (value == 0)
+				{
+					value = INTERVAL_SECONDS;
+				}
+				
+				eeprom_write_dword(&tdc, value);
+			}
 			break;
 		}
-		
-		case LA66_NODOWN:
+		case 0x02: // adaptive tdc shortest interval
 		{
-			LED_TX_set_level(false);
+			if (size != 3)
+			{
+				return false;
+			}
+			
+			uint32_t value = ((uint32_t)data[0] << 16 | data[1] << 8 | data[2]);
+			
+			if (value > 0 && value < TDC_LOWEST)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				if (value == 0)
+				{
+					value = TDC_MIN;
+				}
+				
+				eeprom_write_dword(&tdc_min, value);
+			}
 			break;
 		}
-		
-		default:
+		case 0x03: // adaptive tdc longest interval, 0 disables
+		{
+			if (size != 3)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				eeprom_write_dword(&tdc_max, ((uint32_t)data[0] << 16 | data[1] << 8 | data[2]));
+			}
+			break;
+		}
+		case 0x04: // reset LA66
+		{
+			if (size != 0)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				reset_join();
+			}
+			break;
+		}
+		case 0x05: // baud rate of the UART link to the LA66
+		{
+			if (size != 3)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				uint32_t value = ((uint32_t)data[0] << 16 | data[1] << 8 | data[2]);
+				
+				if (value == 0)
+				{
+					value = LA66_BAUD;
+				}
+				
+				// only kept if the LA66 works at the new rate, otherwise the previous rate is restored
+				if (negotiate_baud(value) == value)
+				{
+					eeprom_write_dword(&la_baud, value);
+				}
+				else
+				{
+					log_serial_P(PSTR("LA66 baud rate not supported, keeping the previous one\r\n"));
+					
+					negotiate_baud(eeprom_read_dword(&la_baud));
+				}
+			}
+			break;
+		}
+		case 0x06: // settings uplink format
+		{
+			if (size != 1)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				eeprom_write_byte(&settings_legacy, data[0] > 0);
+			}
+			break;
+		}
+		case 0x07: // fair use airtime budget per day, 0 disables
+		{
+			if (size != 2)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				eeprom_write_word(&airtime_day, (data[0] << 8 | data[1]));
+			}
+			break;
+		}
+		case 0x08: // link adaption of TX power and confirmed uplinks
+		{
+			if (size != 1)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				eeprom_write_byte(&link_adapt, data[0] > 0);
+				
+				if (data[0] == 0 && tx_power > 0)
+				{
+					set_tx_power(0);
+				}
+			}
+			break;
+		}
+		case 0x09: // time-of-day profile: index, start in minutes (PROFILE_UNUSED clears), tdc, msr_ms, confirmed uplink policy
+		{
+			if (size != 9)
+			{
+				return false;
+			}
+			
+			uint16_t start = data[1] << 8 | data[2];
+			uint32_t value = ((uint32_t)data[3] << 16 | data[4] << 8 | data[5]);
+			
+			if (data[0] >= PROFILE_COUNT || data[8] > PROFILE_CONFIRM_ALL || (start >= 1440 && start != PROFILE_UNUSED) ||
+				(value > 0 && value < TDC_LOWEST))
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				profile *entry = &profiles[(uint8_t)data[0]];
+				
+				// the active profile is switched at the start of the next cycle
+				eeprom_write_word(&entry->start, start);
+				eeprom_write_dword(&entry->tdc, value);
+				eeprom_write_word(&entry->msr_ms, (data[6] << 8 | data[7]));
+				eeprom_write_byte(&entry->confirm, data[8]);
+			}
+			break;
+		}
+		case 0x10: // daily confirmed uplinks
+		{
+			if (size != 1)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				uint8_t value = data[0];
+				
+				eeprom_write_byte(&daily_confirmed_uplinks, value);
+				
+				daily_confirmed_uplink_count = 0;
+			}
+			break;
+		}
+		case 0x20: // maximum fence voltage at ADC max, this depends on actual resistor values
+		{
+			if (size != 2)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				eeprom_write_word(&max_volt, (data[0] << 8 | data[1]));
+			}
+			break;
+		}
+		case 0x21: // measurement delay for each pole
+		{
+			if (size != 2)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				uint16_t value = (data[0] << 8 | data[1]);
+				
+				if (value == 0)
+				{
+					value = MEASURE_MS;
+				}
+				
+				eeprom_write_word(&msr_ms, value);
+			}
+			break;
+		}
+		case 0x22: // measurement batching interval, 0 disables
+		{
+			if (size != 2)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				eeprom_write_word(&msr_interval, (data[0] << 8 | data[1]));
+				
+				batch_count = 0;
+			}
+			break;
+		}
+		case 0x30: // battery low voltage
+		{
+			if (size != 2)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				eeprom_write_word(&bat_low, (data[0] << 8 | data[1]));
+			}
+			break;
+		}
+		case 0x31: // battery low cycle count
+		{
+			if (size != 1)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				eeprom_write_byte(&bat_low_count_max, data[0]);
+			}
+			break;
+		}
+		case 0x32: // battery low minimum voltage
+		{
+			if (size != 2)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				eeprom_write_word(&bat_low_min, (data[0] << 8 | data[1]));
+			}
+			break;
+		}
+		case 0x40: // report by exception fence voltage delta, 0 disables
+		{
+			if (size != 2)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				eeprom_write_word(&rbe_fence_delta, (data[0] << 8 | data[1]));
+			}
+			break;
+		}
+		case 0x41: // report by exception battery voltage delta
+		{
+			if (size != 2)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				eeprom_write_word(&rbe_bat_delta, (data[0] << 8 | data[1]));
+			}
+			break;
+		}
+		case 0x42: // report by exception heartbeat cycles
+		{
+			if (size != 1)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				uint8_t value = data[0];
+				
+				if (value == 0)
+				{
+					value = RBE_HEARTBEAT_CYCLES;
+				}
+				
+				eeprom_write_byte(&rbe_heartbeat, value);
+			}
+			break;
+		}
+		case 0x50: // fence alarm voltage, 0 disables
+		{
+			if (size != 2)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				eeprom_write_word(&alarm_volt, (data[0] << 8 | data[1]));
+			}
+			break;
+		}
+		case 0x51: // fence alarm check interval
+		{
+			if (size != 2)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				uint16_t value = (data[0] << 8 | data[1]);
+				
+				if (value == 0)
+				{
+					value = ALARM_CHECK_INTERVAL;
+				}
+				
+				eeprom_write_word(&alarm_interval, value);
+			}
+			break;
+		}
+		case 0x52: // fence alarm uplinks confirmed
+		{
+			if (size != 1)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				eeprom_write_byte(&alarm_confirm, data[0] > 0);
+			}
+			break;
+		}
+		case 0xFF: // transmit settings next cycle
+		{
+			if (size != 1)
+			{
+				return false;
+			}
+			
+			if (apply)
+			{
+				settings = data[0];
+				
+				if (settings > 0 && settings < SETTINGS_ALL)
+				{
+					if (eeprom_read_dword(&tdc) >= 60)
+					{
+						// see handle_daily_settings() comment for this equal assignement
+						bisect_pause_count = 3;
+					}
+				}
+				// discard out of range commands
+				else if (settings > SETTINGS_PROFILES)
+				{
+					settings = 0;
+				}
+				
+			}
+			break;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+// Multi command downlink: 0xA0 followed by type, length and value of each command,
+// the whole frame is validated before any command is applied.
+// Returns 0 if all commands were applied, otherwise the position of the first invalid entry.
+uint8_t handle_multi_command(uint8_t size)
+{
+	for (uint8_t apply = 0; apply < 2; apply++)
+	{
+		uint8_t pos = 1;
+		uint8_t entry = 0;
+		
+		while (pos < size)
+		{
+			entry++;
+			
+			// type and length must be complete, the value must fit into the frame,
+			// reset, settings request and nested multi commands are not allowed
+			if (pos + 2 > size || pos + 2 + buffer_la[pos + 1] > size ||
+				buffer_la[pos] == 0x04 || buffer_la[pos] == 0xA0 || buffer_la[pos] == 0xFF ||
+				!handle_command(buffer_la[pos], &buffer_la[pos + 2], buffer_la[pos + 1], apply))
+			{
+				return entry;
+			}
+			
+			pos += 2 + buffer_la[pos + 1];
+		}
+		
+		config_ack_entries = entry;
+	}
+	
+	return 0;
+}
+
+void handle_downlink(uint8_t *rxSize)
+{
+	log_serial_P(PSTR("Downlink received...\r\n"));
+	
+	if ((buffer_la[0] & 0xFF) == 0xA0)
+	{
+		config_ack_entries = 0;
+		config_ack_status = handle_multi_command(*rxSize);
+		config_ack = true;
+		
+		snprintf_P(buffer_info, sizeof(buffer_info), PSTR("Multi command downlink, %u commands applied, status %u\r\n"), config_ack_entries, config_ack_status);
+		log_serial(buffer_info);
+	}
+	else
+	{
+		handle_command(buffer_la[0], &buffer_la[1], *rxSize - 1, true);
+	}
+}
+
+void handle_error(LA66_ReturnCode ret)
+{
+	// not sent because of the airtime budget, nothing to recover
+	if (ret == LA66_ERR_BUSY && airtime_blocked)
+	{
+		LED_TX_set_level(false);
+		
+		return;
+	}
+	
+	switch (ret)
+	{
+		case LA66_SUCCESS:
+		case LA66_NODOWN:
+		{
+			break;
+		}
+		
+		// not joined anymore, rejoin right away
+		case LA66_ERR_JOIN:
+		{
+			last_error = ret;
+			break;
+		}
+		
+		// in cycle recovery failed, rejoin only if it keeps failing
+		case LA66_ERR_PANIC:
+		case LA66_ERROR:
+		case LA66_ERR_PARAM:
+		case LA66_ERR_BUSY:
+		case LA66_EOB:
+		{
+			// several failed uplinks within one cycle count as one failed cycle
+			if (!cycle_failed)
+			{
+				cycle_failed = true;
+				failed_transmissions++;
+			}
+			
+			if (failed_transmissions >= RECOVERY_REJOIN_FAILURES)
+			{
+				last_error = ret;
+			}
+			else
+			{
+				snprintf_P(buffer_info, sizeof(buffer_info), PSTR("Transmission failed with %u, failure counter: %u\r\n"), ret, failed_transmissions);
+				log_serial(buffer_info);
+			}
+			break;
+		}
+	}
+}
+
+// Common end of the transmit_* functions: handles a downlink or the error and switches the TX LED off.
+void finish_transmit(LA66_ReturnCode ret, uint8_t *rxSize)
+{
+	switch (ret)
+	{
+		case LA66_SUCCESS:
+		{
+			handle_downlink(rxSize);
+			LED_TX_set_level(false);
+			break;
+		}
+		
+		case LA66_NODOWN:
+		{
+			LED_TX_set_level(false);
+			break;
+		}
+		
+		default:
 		{
 			handle_error(ret);
 			break;
@@ -430,102 +1672,875 @@ void transmit_data(const bool confirm)
 	}
 }
 
-void transmit_settings(const bool confirm)
+// Clears the airtime of slots and hours which left the rolling windows.
+void airtime_update()
+{
+	uint32_t slot = uptime_seconds / 600;
+	
+	while (airtime_slot < slot)
+	{
+		airtime_slot++;
+		airtime_slots[airtime_slot % 6] = 0;
+		
+		if (airtime_slot % 6 == 0)
+		{
+			airtime_hours[(airtime_slot / 6) % 24] = 0;
+		}
+	}
+}
+
+uint32_t airtime_sum(const uint16_t *buckets, uint8_t count)
+{
+	uint32_t sum = 0;
+	
+	for (uint8_t i = 0; i < count; i++)
+	{
+		sum += buckets[i];
+	}
+	
+	return sum;
+}
+
+void airtime_add(uint16_t ms)
+{
+	airtime_update();
+	
+	uint16_t *slot = &airtime_slots[airtime_slot % 6];
+	uint16_t *hour = &airtime_hours[(airtime_slot / 6) % 24];
+	
+	*slot = MIN((uint32_t)*slot + ms, 0xFFFF);
+	*hour = MIN((uint32_t)*hour + ms, 0xFFFF);
+	cycle_airtime += ms;
+}
+
+uint32_t get_airtime_day()
+{
+	airtime_update();
+	
+	return airtime_sum(airtime_hours, 24);
+}
+
+// Returns the airtime in ms left in the rolling hour and, if set, the rolling day budget.
+uint32_t get_airtime_remaining()
+{
+	airtime_update();
+	
+	uint32_t used = airtime_sum(airtime_slots, 6);
+	uint32_t remaining = used < AIRTIME_HOUR_BUDGET ? AIRTIME_HOUR_BUDGET - used : 0;
+	uint32_t budget = eeprom_read_word(&airtime_day) * 1000UL;
+	
+	if (budget > 0)
+	{
+		used = airtime_sum(airtime_hours, 24);
+		remaining = MIN(remaining, used < budget ? budget - used : 0);
+	}
+	
+	return remaining;
+}
+
+// Returns the largest payload up to max bytes which still fits the airtime budgets at dr.
+uint8_t get_airtime_max_payload(uint8_t dr, uint8_t max)
+{
+	uint32_t remaining = get_airtime_remaining();
+	
+	while (max > 0 && LA66_getAirtime(dr, max) > remaining)
+	{
+		max--;
+	}
+	
+	return max;
+}
+
+// Returns the shortest cycle in s in which the airtime of the current cycle
+// stays within the budgets on average.
+uint32_t get_airtime_min_cycle()
+{
+	uint32_t cycle = cycle_airtime * 3600 / AIRTIME_HOUR_BUDGET;
+	uint16_t budget = eeprom_read_word(&airtime_day);
+	
+	if (budget > 0)
+	{
+		cycle = MAX(cycle, cycle_airtime * 864 / (budget * 10UL));
+	}
+	
+	return cycle;
+}
+
+void set_tx_power(uint8_t index)
+{
+	if (LA66_setTxPower(index) == LA66_SUCCESS)
+	{
+		// the average was estimated for the old TX power, new samples include the new one
+		link_margin -= (index - tx_power) * 2 * 4;
+		tx_power = index;
+		
+		snprintf_P(buffer_info, sizeof(buffer_info), PSTR("TX power index set to %u\r\n"), tx_power);
+		log_serial(buffer_info);
+	}
+}
+
+// Updates the link margin from the last downlink and adapts the TX power.
+void update_link()
+{
+	if (!LA66_getLinkQuality(&link_rssi, &link_snr))
+	{
+		return;
+	}
+	
+	// the downlink SNR does not depend on the own TX power, the uplink margin is
+	// estimated from it as symmetric link minus the 2 dB per TX power index below maximum
+	int16_t margin = (link_snr - LA66_getRequiredSnr(LA66_getDr()) - tx_power * 2) * 4;
+	
+	// rolling average with a weight of 1/4 for the new value
+	link_margin = link_valid ? link_margin + (margin - link_margin) / 4 : margin;
+	link_valid = true;
+	
+	if (link_samples_daily < 0xFF) link_samples_daily++;
+	
+	snprintf_P(buffer_info, sizeof(buffer_info), PSTR("RSSI %d dBm, SNR %d dB, link margin %d dB\r\n"), link_rssi, link_snr, link_margin / 4);
+	log_serial(buffer_info);
+	
+	if (eeprom_read_byte(&link_adapt) == 0)
+	{
+		return;
+	}
+	
+	if (link_margin >= LINK_MARGIN_HIGH * 4 && tx_power < TX_POWER_MAX_INDEX)
+	{
+		set_tx_power(tx_power + 1);
+	}
+	else if (link_margin < LINK_MARGIN_LOW * 4 && tx_power > 0)
+	{
+		set_tx_power(tx_power - 1);
+	}
+}
+
+bool get_link_healthy()
+{
+	return link_valid && link_margin >= LINK_MARGIN_HIGH * 4 && failed_transmissions == 0;
+}
+
+// Transmits buffer_la and recovers from errors within the cycle if possible:
+// busy channels are retried with backoff, garbled or missing responses
+// re-synchronize the UART link and are retried once.
+LA66_ReturnCode transmit(uint8_t *fPort, const bool confirm, uint8_t *rxSize)
+{
+	uint8_t busy_retries = 0;
+	bool resynced = false;
+	uint8_t dr = LA66_getDr();
+	uint8_t size = strlen(buffer_la) / 2;
+	uint16_t airtime = LA66_getAirtime(dr, size);
+	
+	// payloads are composed for the cached DR, anything longer would only be rejected by the LA66
+	if (size > LA66_getMaxPayload(dr))
+	{
+		snprintf_P(buffer_info, sizeof(buffer_info), PSTR("Payload of %u bytes too long for DR%u, skipping uplink...\r\n"), size, dr);
+		log_serial(buffer_info);
+		
+		return LA66_ERR_PARAM;
+	}
+	
+	// never exceed the duty cycle or fair use budget, the uplink is dropped like a busy channel
+	airtime_blocked = airtime > get_airtime_remaining();
+	
+	if (airtime_blocked)
+	{
+		snprintf_P(buffer_info, sizeof(buffer_info), PSTR("Airtime budget exhausted, skipping uplink of %u ms...\r\n"), airtime);
+		log_serial(buffer_info);
+		
+		return LA66_ERR_BUSY;
+	}
+	
+	// the whole transaction is accounted as RX, the time on air is moved to TX afterwards
+	uint8_t phase = energy_enter(ENERGY_RX);
+	
+	LA66_ReturnCode ret = LA66_transmitB(fPort, confirm, buffer_la, rxSize);
+	uint8_t on_air = LA66_getTxCount();
+	
+	// a repetition for a lost acknowledgement is the only collision a device can detect
+	if (confirm && on_air > 1)
+	{
+		slot_rotation++;
+	}
+	
+	while (1)
+	{
+		if (ret == LA66_ERR_BUSY && busy_retries < TX_BUSY_RETRIES)
+		{
+			uint16_t backoff = (TX_BUSY_BACKOFF << busy_retries) + rand() % (TX_BUSY_BACKOFF << busy_retries);
+			
+			busy_retries++;
+			if (busy_retry_count < 0xFF) busy_retry_count++;
+			if (busy_events_daily < 0xFFFF) busy_events_daily++;
+			
+			snprintf_P(buffer_info, sizeof(buffer_info), PSTR("Channels busy, retrying in %u seconds...\r\n"), backoff);
+			log_serial(buffer_info);
+			idle_ms(100);
+			
+			// let the LA66 sleep too, the backoff does not count as awake time
+			LA66_sleep();
+			
+			// an alarm found meanwhile is sent when the cycle goes to sleep, the backoff is kept
+			uint32_t backoff_end = get_uptime() + backoff;
+			
+			while (1)
+			{
+				uint32_t now = get_uptime();
+				
+				if (now >= backoff_end || !power_save(backoff_end - now))
+				{
+					break;
+				}
+				
+				log_serial_P(PSTR("Alarm uplink due, sent after this uplink\r\n"));
+			}
+			
+			radio_wakeup_day_seconds += backoff;
+			
+			if (LA66_wakeup() != LA66_SUCCESS)
+			{
+				ret = LA66_ERROR;
+				break;
+			}
+		}
+		else if ((ret == LA66_ERROR || ret == LA66_ERR_PANIC || ret == LA66_EOB) && !resynced)
+		{
+			resynced = true;
+			if (resync_count < 0xFF) resync_count++;
+			
+			log_serial_P(PSTR("Re-synchronizing LA66...\r\n"));
+			
+			if (LA66_resync() != LA66_SUCCESS)
+			{
+				break;
+			}
+		}
+		else
+		{
+			break;
+		}
+		
+		ret = LA66_transmitB(fPort, confirm, buffer_la, rxSize);
+		on_air += LA66_getTxCount();
+	}
+	
+	energy_enter(phase);
+	
+	// every transmission counts: repetitions of confirmed uplinks, uplinks re-sent after
+	// a resync and uplinks which went on air but failed afterwards
+	for (uint8_t i = 0; i < on_air; i++)
+	{
+		airtime_add(airtime);
+		energy_shift(ENERGY_RX, ENERGY_TX, airtime);
+	}
+	
+	if (ret == LA66_SUCCESS || ret == LA66_NODOWN)
+	{
+		failed_transmissions = 0;
+		
+		update_link();
+	}
+	// a lost uplink might be caused by a too low TX power
+	else if (ret != LA66_ERR_BUSY && tx_power > 0)
+	{
+		link_valid = false;
+		
+		set_tx_power(0);
+	}
+	else if (ret == LA66_ERR_BUSY)
+	{
+		if (busy_events_daily < 0xFFFF) busy_events_daily++;
+		if (busy_lost_daily < 0xFF) busy_lost_daily++;
+	}
+	
+	return ret;
+}
+
+bool get_time_sync_due()
+{
+	return get_uptime() - sync_attempt_uptime >= (time_synced ? sync_interval : TIME_SYNC_MIN_INTERVAL) ||
+		(!time_synced && sync_attempt_uptime == 0);
+}
+
+// Syncs the time with the network (DeviceTimeReq) and measures the drift of
+// the 32 kHz crystal since the last sync, the correction is applied in the TIMER2 tick.
+void sync_time()
+{
+	sync_attempt_uptime = get_uptime();
+	
+	log_serial_P(PSTR("Syncing time...\r\n"));
+	
+	LA66_ReturnCode ret = LA66_synctime();
+	
+	// the DeviceTimeReq is an uplink without payload
+	for (uint8_t i = 0; i < LA66_getTxCount(); i++)
+	{
+		airtime_add(LA66_getAirtime(LA66_getDr(), 0));
+	}
+	
+	if (ret != LA66_SUCCESS)
+	{
+		log_serial_P(PSTR("Time sync failed!\r\n"));
+		
+		sync_interval = TIME_SYNC_MIN_INTERVAL;
+		return;
+	}
+	
+	uint32_t timestamp = LA66_getTimestamp();
+	uint32_t uptime = get_uptime();
+	
+	if (timestamp == 0)
+	{
+		return;
+	}
+	
+	if (time_synced)
+	{
+		int32_t expected = timestamp - sync_timestamp;
+		int32_t error = (int32_t)(uptime - sync_uptime) - expected;
+		
+		// the error since the last sync is the remaining drift on top of the current correction,
+		// an error beyond what the crystal can drift is a jump of the time, not a drift
+		if (labs(error) > expected / 1000 + TIME_SYNC_TOLERANCE)
+		{
+			log_serial_P(PSTR("Clock error too large for a drift, resyncing\r\n"));
+		}
+		else if (expected >= 60L * 60)
+		{
+			int32_t ppm = drift_ppm + (int64_t)error * 1000000L / expected;
+			
+			ppm = MAX(MIN(ppm, CLOCK_DRIFT_MAX), -CLOCK_DRIFT_MAX);
+			
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+			{
+				drift_ppm = ppm;
+			}
+			
+			eeprom_update_word((uint16_t *)&clock_drift, ppm);
+		}
+		
+		sync_interval = labs(error) <= TIME_SYNC_TOLERANCE ? MIN(sync_interval * 2, TIME_SYNC_MAX_INTERVAL) : TIME_SYNC_MIN_INTERVAL;
+		
+		snprintf_P(buffer_info, sizeof(buffer_info), PSTR("Clock error %ld s in %ld s, drift %d ppm\r\n"), error, expected, drift_ppm);
+		log_serial(buffer_info);
+	}
+	
+	sync_timestamp = timestamp;
+	sync_uptime = uptime;
+	time_synced = true;
+	time_align = true;
+}
+
+uint32_t get_network_time()
+{
+	return sync_timestamp + (get_uptime() - sync_uptime);
+}
+
+// FNV-1a hash over the serial number of the MCU and salt.
+uint32_t get_device_hash(uint32_t salt)
+{
+	uint32_t hash = 2166136261UL;
+	
+	for (uint8_t i = 14; i < 24; i++)
+	{
+		hash = (hash ^ boot_signature_byte_get(i)) * 16777619UL;
+	}
+	
+	for (uint8_t i = 0; i < 32; i += 8)
+	{
+		hash = (hash ^ (uint8_t)(salt >> i)) * 16777619UL;
+	}
+	
+	return hash;
+}
+
+// Returns the offset in s of the own transmit slot in the cycle starting at the network time start.
+// The slot is derived from the device hash, so devices spread evenly even if they joined at once.
+// It is kept for TX_SLOT_RESEED and moved after a detected collision, so two devices sharing
+// a slot part and a fleet settles into free slots (see scripts/slot_sim.js).
+uint32_t get_slot_offset(uint32_t start, uint32_t cycle, uint16_t width)
+{
+	// more slots than 0xFFFF do not spread any further
+	uint32_t span = MIN(cycle, 0xFFFFUL * width / 1000);
+	uint16_t slots = MAX(span * 1000 / width, 1);
+	uint32_t salt = start / TX_SLOT_RESEED | (uint32_t)slot_rotation << 24;
+	
+	return (get_device_hash(salt) % slots) * width / 1000;
+}
+
+// Returns the seconds until the next own transmit slot. The network time is divided into
+// cycles of cycle seconds, each into slots of the airtime of a data uplink at TX_SLOT_DR
+// plus TX_SLOT_GUARD_MS.
+uint32_t get_slot_wait(uint32_t cycle)
+{
+	uint16_t width = LA66_getAirtime(TX_SLOT_DR, TX_SLOT_PAYLOAD) + TX_SLOT_GUARD_MS;
+	uint32_t now = get_network_time();
+	uint32_t index = now / cycle + 1;
+	uint32_t start = index * cycle + get_slot_offset(index * cycle, cycle, width);
+	
+	// slot of the next cycle is too close, take the one after
+	if (start - now < width / 1000 + 1)
+	{
+		index++;
+		start = index * cycle + get_slot_offset(index * cycle, cycle, width);
+	}
+	
+	return start - now;
+}
+
+// Aligns day_seconds to the network time, only called at the start of a cycle
+// as the cycle timing relies on day_seconds.
+void align_time()
+{
+	uint32_t now = get_network_time() % 86400;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		// the network day already began, let the rollover happen
+		if (now + 43200 < day_seconds)
+		{
+			now += 86400;
+		}
+		// the local day already began, going back would roll over a second time,
+		// the clock stays a few seconds ahead until the next alignment
+		else if (day_seconds + 43200 < now)
+		{
+			now = 0;
+		}
+		
+		day_seconds = now;
+	}
+	
+	time_align = false;
+}
+
+void transmit_data(const bool confirm)
+{
+	LED_TX_set_level(true);
+
+	uint8_t fPort = 1;
+	uint8_t rxSize = 0;
+
+	if (confirm)
+	{
+		log_serial_P(PSTR("Transmitting data confirmed...\r\n"));
+	}
+	else
+	{
+		log_serial_P(PSTR("Transmitting data...\r\n"));
+	}
+
+	if (daily_cycle_count == 1)
+	{
+		uint32_t values[] = { 1, volt_bat, volt_fence_plus / CODEC_FENCE_STEP, volt_fence_minus / CODEC_FENCE_STEP, VERSION };
+		
+		codec_encode(buffer_la, codec_data_version, values);
+	}
+	else
+	{
+		uint32_t values[] = { 0, volt_bat, volt_fence_plus / CODEC_FENCE_STEP, volt_fence_minus / CODEC_FENCE_STEP };
+		
+		codec_encode(buffer_la, codec_data, values);
+	}
+
+	LA66_ReturnCode ret = transmit(&fPort, confirm, &rxSize);
+	
+	if (ret == LA66_SUCCESS || ret == LA66_NODOWN)
+	{
+		sent_volt_bat = volt_bat;
+		sent_volt_fence_plus = volt_fence_plus;
+		sent_volt_fence_minus = volt_fence_minus;
+		unreported_cycles = 0;
+	}
+	
+	finish_transmit(ret, &rxSize);
+}
+
+// Zigzag encoding of a signed delta, small magnitudes give small values.
+uint16_t zigzag(int16_t value)
+{
+	return value < 0 ? ((uint16_t)(-value) << 1) - 1 : (uint16_t)value << 1;
+}
+
+uint8_t bit_length(uint16_t value)
+{
+	uint8_t bits = 0;
+	
+	while (value)
+	{
+		bits++;
+		value >>= 1;
+	}
+	
+	return bits;
+}
+
+// Encodes the newest samples of the batch which fit into max_payload bytes.
+// Header: samples - 1 (4), delta width (4), interval (16), battery (12), first positive (12), first negative (12),
+// followed by zigzag encoded deltas of positive and negative for each further sample.
+uint8_t encode_batch(uint8_t max_payload)
+{
+	uint8_t first = 0;
+	uint8_t width = 0;
+	
+	// find the delta width of all samples, then drop the oldest while it does not fit
+	for (uint8_t i = 1; i < batch_count; i++)
+	{
+		width = MAX(width, bit_length(zigzag(batch_fence_plus[i] - batch_fence_plus[i - 1])));
+		width = MAX(width, bit_length(zigzag(batch_fence_minus[i] - batch_fence_minus[i - 1])));
+	}
+	
+	while (first < batch_count - 1 && 60 + (uint16_t)(batch_count - first - 1) * width * 2 > max_payload * 8)
+	{
+		first++;
+	}
+	
+	codec_writer writer;
+	
+	codec_begin(&writer, buffer_la);
+	codec_put(&writer, batch_count - first - 1, 4);
+	codec_put(&writer, width, 4);
+	codec_put(&writer, eeprom_read_word(&msr_interval), 16);
+	codec_put(&writer, volt_bat, 12);
+	codec_put(&writer, batch_fence_plus[first], 12);
+	codec_put(&writer, batch_fence_minus[first], 12);
+	
+	for (uint8_t i = first + 1; i < batch_count; i++)
+	{
+		codec_put(&writer, zigzag(batch_fence_plus[i] - batch_fence_plus[i - 1]), width);
+		codec_put(&writer, zigzag(batch_fence_minus[i] - batch_fence_minus[i - 1]), width);
+	}
+	
+	codec_end(&writer);
+	
+	return batch_count - first;
+}
+
+void transmit_batch(const bool confirm)
+{
+	LED_TX_set_level(true);
+
+	uint8_t fPort = 6;
+	uint8_t rxSize = 0;
+	uint8_t dr = LA66_getDr();
+	uint8_t max_payload = MIN(LA66_getMaxPayload(dr), (LA66_MAX_BUFF - 1) / 2);
+	
+	// shrink the batch to what the airtime budget allows, transmit() skips it if not even one sample fits
+	max_payload = get_airtime_max_payload(dr, max_payload);
+	uint8_t samples = encode_batch(max_payload);
+
+	snprintf_P(buffer_info, sizeof(buffer_info), PSTR("Transmitting %u samples...\r\n"), samples);
+	log_serial(buffer_info);
+
+	LA66_ReturnCode ret = transmit(&fPort, confirm, &rxSize);
+	
+	if (ret == LA66_SUCCESS || ret == LA66_NODOWN)
+	{
+		sent_volt_bat = volt_bat;
+		sent_volt_fence_plus = volt_fence_plus;
+		sent_volt_fence_minus = volt_fence_minus;
+		unreported_cycles = 0;
+		batch_count = 0;
+	}
+	
+	finish_transmit(ret, &rxSize);
+}
+
+// Reads all settings in the order of the single settings uplink.
+void read_settings(uint32_t *values)
+{
+	values[0] = eeprom_read_dword(&tdc);
+	values[1] = eeprom_read_byte(&daily_confirmed_uplinks);
+	values[2] = eeprom_read_word(&max_volt);
+	values[3] = eeprom_read_word(&msr_ms);
+	values[4] = eeprom_read_word(&bat_low);
+	values[5] = eeprom_read_byte(&bat_low_count_max);
+	values[6] = eeprom_read_word(&bat_low_min);
+	values[7] = eeprom_read_dword(&la_baud);
+	values[8] = eeprom_read_word(&rbe_fence_delta);
+	values[9] = eeprom_read_word(&rbe_bat_delta);
+	values[10] = eeprom_read_byte(&rbe_heartbeat);
+	values[11] = eeprom_read_word(&alarm_volt);
+	values[12] = eeprom_read_word(&alarm_interval);
+	values[13] = eeprom_read_byte(&alarm_confirm);
+	values[14] = eeprom_read_word(&msr_interval);
+	values[15] = eeprom_read_word(&airtime_day);
+	values[16] = eeprom_read_byte(&link_adapt);
+	values[17] = eeprom_read_dword(&tdc_min);
+	values[18] = eeprom_read_dword(&tdc_max);
+}
+
+// CRC-16/XMODEM over all settings, each as 4 bytes big endian,
+// allows the server to verify the whole configuration at once.
+// The values are clamped to their fields in codec_settings like in the settings uplink.
+uint16_t get_config_crc(const uint32_t *values)
+{
+	uint16_t crc = 0;
+	
+	for (uint8_t i = 0; i < SETTINGS_COUNT; i++)
+	{
+		// the first field is the version
+		uint32_t value = codec_clamp(values[i], pgm_read_byte(&codec_settings[i + 2]));
+		
+		for (int8_t shift = 24; shift >= 0; shift -= 8)
+		{
+			crc = _crc_xmodem_update(crc, value >> shift);
+		}
+	}
+	
+	return crc;
+}
+
+void transmit_settings(const bool confirm)
+{
+	LED_TX_set_level(true);
+	
+	uint8_t fPort = settings + 1;
+	uint8_t rxSize = 0;
+	
+	if (confirm)
+	{
+		log_serial_P(PSTR("Transmitting settings confirmed...\r\n"));
+	}
+	else
+	{
+		log_serial_P(PSTR("Transmitting settings...\r\n"));
+	}
+	
+	switch (settings)
+	{
+		case 1:
+		{
+			uint32_t values[] = { VERSION, eeprom_read_dword(&tdc), eeprom_read_byte(&daily_confirmed_uplinks) };
+			
+			codec_encode(buffer_la, codec_settings_1, values);
+			break;
+		}
+		
+		case 2:
+		{
+			uint32_t values[] = { VERSION, eeprom_read_word(&max_volt), eeprom_read_word(&msr_ms) };
+			
+			codec_encode(buffer_la, codec_settings_2, values);
+			break;
+		}
+		
+		case 3:
+		{
+			uint32_t values[] = { VERSION, eeprom_read_word(&bat_low), eeprom_read_byte(&bat_low_count_max), eeprom_read_word(&bat_low_min) };
+			
+			codec_encode(buffer_la, codec_settings_3, values);
+			break;
+		}
+		
+		case SETTINGS_ALL:
+		{
+			uint32_t values[SETTINGS_COUNT + 2];
+			
+			fPort = 7;
+			
+			values[0] = VERSION;
+			read_settings(&values[1]);
+			values[SETTINGS_COUNT + 1] = get_config_crc(&values[1]);
+			
+			codec_encode(buffer_la, codec_settings, values);
+			break;
+		}
+		
+		case SETTINGS_PROFILES:
+		{
+			uint32_t values[1 + PROFILE_COUNT * 4];
+			
+			fPort = 9;
+			
+			values[0] = VERSION;
+			
+			for (uint8_t i = 0; i < PROFILE_COUNT; i++)
+			{
+				values[1 + i * 4] = eeprom_read_word(&profiles[i].start);
+				values[2 + i * 4] = eeprom_read_dword(&profiles[i].tdc);
+				values[3 + i * 4] = eeprom_read_word(&profiles[i].msr_ms);
+				values[4 + i * 4] = eeprom_read_byte(&profiles[i].confirm);
+			}
+			
+			codec_encode(buffer_la, codec_profiles, values);
+			break;
+		}
+	}
+	
+	settings = 0;
+	
+	LA66_ReturnCode ret = transmit(&fPort, confirm, &rxSize);
+
+	finish_transmit(ret, &rxSize);
+}
+
+void transmit_config_ack(const bool confirm)
+{
+	LED_TX_set_level(true);
+	
+	uint8_t fPort = 8;
+	uint8_t rxSize = 0;
+	uint32_t settings_values[SETTINGS_COUNT];
+	
+	log_serial_P(PSTR("Transmitting config ack...\r\n"));
+	
+	read_settings(settings_values);
+	
+	uint32_t values[] = { config_ack_status, config_ack_entries, get_config_crc(settings_values) };
+	
+	codec_encode(buffer_la, codec_config_ack, values);
+	
+	config_ack = false;
+	
+	LA66_ReturnCode ret = transmit(&fPort, confirm, &rxSize);
+
+	finish_transmit(ret, &rxSize);
+}
+
+void transmit_error(const bool confirm)
+{
+	LED_TX_set_level(true);
+	
+	uint8_t fPort = 223;
+	uint8_t rxSize = 0;
+	
+	log_serial_P(PSTR("Transmitting error...\r\n"));
+	
+	uint32_t values[] = { last_error, busy_retry_count, resync_count, rejoin_count };
+	
+	codec_encode(buffer_la, codec_error, values);
+	
+	LA66_ReturnCode ret = transmit(&fPort, confirm, &rxSize);
+	
+	// counters are reported, start over
+	if (ret == LA66_SUCCESS || ret == LA66_NODOWN)
+	{
+		busy_retry_count = 0;
+		resync_count = 0;
+		rejoin_count = 0;
+	}
+
+	finish_transmit(ret, &rxSize);
+}
+
+void transmit_diagnostics(const bool confirm)
+{
+	LED_TX_set_level(true);
+	
+	uint8_t fPort = 222;
+	uint8_t rxSize = 0;
+	
+	log_serial_P(PSTR("Transmitting diagnostics...\r\n"));
+	
+	uint16_t params_hits;
+	uint16_t params_misses;
+	
+	LA66_getParamStats(&params_hits, &params_misses);
+	
+	energy_enter(energy_phase);
+	
+	uint32_t charge = 0;
+	
+	for (uint8_t i = 0; i < ENERGY_PHASES; i++)
+	{
+		charge += get_energy_charge(i);
+	}
+	
+	snprintf_P(buffer_info, sizeof(buffer_info), PSTR("Charge estimate since last diagnostics: %lu.%02lu mAh\r\n"), charge / 100, charge % 100);
+	log_serial(buffer_info);
+	
+	uint32_t values[] = { busy_events_daily, busy_lost_daily, get_airtime_day() / 100,
+		link_samples_daily, -link_rssi, link_snr + 128, link_margin / 4 + 128, tx_power, params_hits, params_misses,
+		drift_ppm + 512, time_synced,
+		get_energy_charge(ENERGY_AWAKE), get_energy_charge(ENERGY_SLEEP), get_energy_charge(ENERGY_BOOT), get_energy_charge(ENERGY_JOIN),
+		get_energy_charge(ENERGY_SETTLE), get_energy_charge(ENERGY_FENCE_PLUS), get_energy_charge(ENERGY_FENCE_MINUS),
+		get_energy_charge(ENERGY_TX), get_energy_charge(ENERGY_RX), get_energy_charge(ENERGY_LOG) };
+	
+	codec_encode(buffer_la, codec_diagnostics, values);
+	
+	// the counters keep running during the transmission, only what was sent is cleared afterwards
+	uint32_t sent_ticks[ENERGY_PHASES];
+	
+	memcpy(sent_ticks, energy_ticks, sizeof(energy_ticks));
+	
+	LA66_ReturnCode ret = transmit(&fPort, confirm, &rxSize);
+	
+	// a lost diagnostics uplink is repeated with the next cycle
+	if (ret == LA66_SUCCESS || ret == LA66_NODOWN)
+	{
+		for (uint8_t i = 0; i < ENERGY_PHASES; i++)
+		{
+			energy_ticks[i] -= MIN(energy_ticks[i], sent_ticks[i]);
+		}
+		
+		diagnostics = false;
+		link_samples_daily -= MIN(link_samples_daily, values[3]);
+		busy_events_daily -= MIN(busy_events_daily, values[0]);
+		busy_lost_daily -= MIN(busy_lost_daily, values[1]);
+	}
+
+	finish_transmit(ret, &rxSize);
+}
+
+// An alarm or recovery uplink is due if the alarm state differs from the last
+// reported one and the last alarm uplink is at least ALARM_MIN_INTERVAL ago.
+bool get_alarm_due()
+{
+	if (!joined || fence_alarm == fence_alarm_reported)
+	{
+		return false;
+	}
+	
+	return !fence_alarm_sent || uptime_seconds - fence_alarm_uptime >= ALARM_MIN_INTERVAL;
+}
+
+void transmit_alarm(const bool confirm)
 {
 	LED_TX_set_level(true);
 	
-	uint8_t fPort = settings + 1;
+	uint8_t fPort = 5;
 	uint8_t rxSize = 0;
 	
-	if (confirm)
+	if (fence_alarm)
 	{
-		log_serial_P(PSTR("Transmitting settings confirmed...\r\n"));
+		log_serial_P(PSTR("Transmitting fence alarm...\r\n"));
 	}
 	else
 	{
-		log_serial_P(PSTR("Transmitting settings...\r\n"));
+		log_serial_P(PSTR("Transmitting fence recovery...\r\n"));
 	}
 	
-	switch (settings)
-	{
-		case 1:
-		snprintf_P(buffer_la, sizeof(buffer_la), PSTR("%02X%06lX%02X"), VERSION, eeprom_read_dword(&tdc), eeprom_read_byte(&daily_confirmed_uplinks));
-		break;
-		
-		case 2:
-		snprintf_P(buffer_la, sizeof(buffer_la), PSTR("%02X%04X%04X"), VERSION, eeprom_read_word(&max_volt), eeprom_read_word(&msr_ms));
-		break;
-		
-		case 3:
-		snprintf_P(buffer_la, sizeof(buffer_la), PSTR("%02X%04X%02X%04X"), VERSION, eeprom_read_word(&bat_low), eeprom_read_byte(&bat_low_count_max), eeprom_read_word(&bat_low_min));
-		break;
-	}
+	uint32_t values[] = { fence_alarm, alarm_volt_fence_plus / CODEC_FENCE_STEP, alarm_volt_fence_minus / CODEC_FENCE_STEP };
 	
-	settings = 0;
+	codec_encode(buffer_la, codec_alarm, values);
 	
-	LA66_ReturnCode ret = LA66_transmitB(&fPort, confirm, buffer_la, &rxSize);
-
-	switch (ret)
+	fence_alarm_sent = true;
+	fence_alarm_uptime = uptime_seconds;
+	
+	LA66_ReturnCode ret = transmit(&fPort, confirm, &rxSize);
+	
+	if (ret == LA66_SUCCESS || ret == LA66_NODOWN)
 	{
-		case LA66_SUCCESS:
-		{
-			handle_downlink(&rxSize);
-			LED_TX_set_level(false);
-			break;
-		}
-		
-		case LA66_NODOWN:
-		{
-			LED_TX_set_level(false);
-			break;
-		}
-		
-		default:
-		{
-			handle_error(ret);
-			break;
-		}
+		fence_alarm_reported = fence_alarm;
 	}
+
+	finish_transmit(ret, &rxSize);
 }
 
-void transmit_error(const bool confirm)
+void handle_daily_settings()
 {
-	LED_TX_set_level(true);
-	
-	uint8_t fPort = 223;
-	uint8_t rxSize = 0;
-	
-	log_serial_P(PSTR("Transmitting error...\r\n"));
-	
-	snprintf_P(buffer_la, sizeof(buffer_la), PSTR("%02X"), last_error);
-	
-	LA66_ReturnCode ret = LA66_transmitB(&fPort, confirm, buffer_la, &rxSize);
-
-	switch (ret)
+	// all settings in one uplink after the first normal data uplink of the day
+	if (eeprom_read_byte(&settings_legacy) == 0)
 	{
-		case LA66_SUCCESS:
-		{
-			handle_downlink(&rxSize);
-			LED_TX_set_level(false);
-			break;
-		}
-		
-		case LA66_NODOWN:
+		if (daily_cycle_count == 1)
 		{
-			LED_TX_set_level(false);
-			break;
+			settings = SETTINGS_ALL;
 		}
 		
-		default:
-		{
-			handle_error(ret);
-			break;
-		}
+		return;
 	}
-}
-
-void handle_daily_settings()
-{
+	
 	// daily_cycle_count is 1/4 of daily max uplink count
 	if (daily_cycle_count == 1)
 	{
@@ -554,11 +2569,24 @@ void handle_daily_settings()
 
 bool get_uplink_confirmation()
 {
+	uint8_t policy = active_profile >= 0 ? eeprom_read_byte(&profiles[active_profile].confirm) : PROFILE_CONFIRM_DAILY;
+	
+	// daily confirmed uplinks due meanwhile are sent after the profile
+	if (policy == PROFILE_CONFIRM_NONE)
+		return false;
+	
+	if (policy == PROFILE_CONFIRM_ALL)
+		return true;
+	
 	uint8_t _daily_confirmed_uplinks = eeprom_read_byte(&daily_confirmed_uplinks);
 
     if (_daily_confirmed_uplinks == 0)
         return false;
 
+    // a clearly healthy link needs less confirmation
+    if (eeprom_read_byte(&link_adapt) > 0 && get_link_healthy())
+        _daily_confirmed_uplinks = (_daily_confirmed_uplinks + 1) / 2;
+
     // Calculate the interval in seconds between confirmed uplinks
     uint32_t interval = 86400UL / (_daily_confirmed_uplinks + 1);
 
@@ -574,6 +2602,48 @@ bool get_uplink_confirmation()
     return false;
 }
 
+uint16_t delta(uint16_t a, uint16_t b)
+{
+	return a > b ? a - b : b - a;
+}
+
+// Report by exception: only send data if a value changed by more than its
+// threshold since the last uplink or if the heartbeat is due.
+bool get_report_required()
+{
+	uint16_t fence_delta = eeprom_read_word(&rbe_fence_delta);
+	
+	// disabled
+	if (fence_delta == 0)
+	{
+		return true;
+	}
+	
+	// first uplink of the day includes the version
+	if (daily_cycle_count == 1)
+	{
+		return true;
+	}
+	
+	if (++unreported_cycles >= eeprom_read_byte(&rbe_heartbeat))
+	{
+		log_serial_P(PSTR("Heartbeat due...\r\n"));
+		
+		return true;
+	}
+	
+	if (delta(volt_fence_plus, sent_volt_fence_plus) >= fence_delta ||
+		delta(volt_fence_minus, sent_volt_fence_minus) >= fence_delta ||
+		delta(volt_bat, sent_volt_bat) >= eeprom_read_word(&rbe_bat_delta))
+	{
+		log_serial_P(PSTR("Threshold crossed...\r\n"));
+		
+		return true;
+	}
+	
+	return false;
+}
+
 void seed_rand()
 {
 	uint16_t seed = 0;
@@ -630,14 +2700,89 @@ void deactivate()
 	LED_MSR_set_level(false);
 	LED_TX_set_level(false);
 
-	sleep_set_mode(2); // set to power down mode
-
 	ACTIVATE_set_level(false);
 
-	sleep_enable();
-	while (1)
+	power_off();
+}
+
+// Adaptive tdc: the interval is shortened to tdc_min while the fence is faulty or recovering,
+// doubled for each TDC_STABLE_SECONDS the fence is stable and stretched towards tdc_max
+// as the battery approaches bat_low. The fence state is only known with the fence alarm enabled.
+uint32_t get_tdc()
+{
+	uint32_t _tdc = get_profile_tdc();
+	uint32_t _tdc_min = eeprom_read_dword(&tdc_min);
+	uint32_t _tdc_max = eeprom_read_dword(&tdc_max);
+	
+	// the downlinks set 24 bit values, anything above is erased EEPROM and disables the adaptive tdc
+	if (_tdc_min > 0xFFFFFF)
+	{
+		_tdc_min = 0;
+	}
+	
+	if (_tdc_max > 0xFFFFFF)
+	{
+		_tdc_max = 0;
+	}
+	
+	if (_tdc_max == 0)
+	{
+		return _tdc;
+	}
+	
+	if (eeprom_read_word(&alarm_volt) > 0)
+	{
+		uint32_t stable = uptime_seconds - fence_change_uptime;
+		
+		if (fence_alarm || (fence_alarm_seen && stable < TDC_RECOVERY_SECONDS))
+		{
+			_tdc = _tdc_min;
+		}
+		else if (stable >= TDC_STABLE_SECONDS)
+		{
+			_tdc <<= MIN(stable / TDC_STABLE_SECONDS, 8);
+		}
+	}
+	
+	uint16_t _bat_low = eeprom_read_word(&bat_low);
+	
+	if (volt_bat > 0 && volt_bat < _bat_low + TDC_BATTERY_MARGIN && _tdc < _tdc_max)
+	{
+		uint16_t margin = volt_bat > _bat_low ? volt_bat - _bat_low : 0;
+		
+		_tdc += (_tdc_max - _tdc) / TDC_BATTERY_MARGIN * (TDC_BATTERY_MARGIN - margin);
+	}
+	
+	return MAX(_tdc_min, MIN(_tdc, _tdc_max));
+}
+
+// Sleeps for sec seconds, alarm and recovery uplinks interrupt the sleep,
+// then it sleeps on for the rest of the time.
+void sleep(uint32_t sec)
+{
+	uint32_t sleep_start_day_seconds = day_seconds;
+	
+	// an alarm found while the cycle was running (busy backoff, measurement) is sent first
+	while (get_alarm_due() || power_save(sec))
 	{
-		sleep_mode();
+		radio_wakeup();
+		
+		transmit_alarm(eeprom_read_byte(&alarm_confirm));
+		
+		LA66_sleep();
+		
+		uint32_t slept = day_seconds - sleep_start_day_seconds;
+		
+		if (slept >= sec)
+		{
+			break;
+		}
+		
+		sec -= slept;
+		sleep_start_day_seconds = day_seconds;
+		
+		// the adaptive tdc shortens the rest of the cycle if the fence failed
+		sec = MIN(sec, get_tdc());
 	}
 }
 
@@ -647,7 +2792,14 @@ void pause()
 	
 	if (bisect_pause_count > 0) bisect_pause_count--;
 	
-	uint32_t _tdc = eeprom_read_dword(&tdc);
+	uint32_t cycle_tdc = get_tdc();
+	uint32_t _tdc = cycle_tdc;
+	
+	if (cycle_tdc != get_profile_tdc())
+	{
+		snprintf_P(buffer_info, sizeof(buffer_info), PSTR("Adaptive tdc: %lu seconds\r\n"), cycle_tdc);
+		log_serial(buffer_info);
+	}
 	int8_t deviation = rand() % (RANDOMNESS * 2) - RANDOMNESS;
 	
 	_tdc /= (bisect_pause_count > 0 ? 2 : 1);
@@ -668,20 +2820,116 @@ void pause()
 	// if next cycle is the last bisected or not bisected it is a normal so apply the correction
 	else if (bisect_pause_count <= 1)
 	{
-		_tdc -= elapsed + bisect_cycle_seconds;
+		uint32_t spent = elapsed + bisect_cycle_seconds;
+		
+		// a cycle which took longer than the interval (joins, busy backoffs, several uplinks)
+		// still sleeps a little instead of wrapping around
+		_tdc = _tdc > spent + CYCLE_MIN_SLEEP ? _tdc - spent : CYCLE_MIN_SLEEP;
 
 		bisect_cycle_seconds = 0;
 	}
+	
+	// collision avoiding slots instead of random deviation once the time is synced
+	if (time_synced && bisect_pause_count == 0 && cycle_tdc >= 60)
+	{
+		_tdc = get_slot_wait(cycle_tdc);
+	}
+	
+	// end the cycle when the next time-of-day profile starts
+	uint32_t profile_left = get_profile_left();
+	
+	if (profile_left > 0 && _tdc > profile_left)
+	{
+		_tdc = profile_left;
+	}
+	
+	// stretch the cycle if the airtime used would exceed the budgets in the long run
+	uint32_t min_cycle = get_airtime_min_cycle();
+	
+	if (_tdc + elapsed < min_cycle)
+	{
+		_tdc = min_cycle - elapsed;
+		
+		log_serial_P(PSTR("Stretching cycle to stay within airtime budget...\r\n"));
+	}
+
+	if (joined)
+	{
+		radio_sleep();
+	}
 
 	snprintf_P(buffer_info, sizeof(buffer_info), PSTR("Sleeping for %lu seconds...\r\n"), _tdc);
 	log_serial(buffer_info);
-	_delay_ms(100);
+	idle_ms(100);
+	
+	uint16_t interval = eeprom_read_word(&msr_interval);
 	
-	power_save(_tdc);
+	// measurement batching, the last measurement is taken at the start of the next cycle
+	if (interval > 0)
+	{
+		while (_tdc > interval)
+		{
+			sleep(interval);
+			
+			uint32_t measure_start_day_seconds = day_seconds;
+			
+			measure();
+			
+			_tdc -= MIN(_tdc, interval + (day_seconds - measure_start_day_seconds));
+		}
+	}
+	
+	sleep(_tdc);
+	
+	elapsed = day_seconds - cycle_start_day_seconds;
+	join_backoff_seconds = join_backoff_seconds > elapsed ? join_backoff_seconds - elapsed : 0;
 
 	LED_IDLE_set_level(false);
 }
 
+// Settings are appended to the EEPROM layout, an update which preserves the EEPROM leaves them
+// erased (0xFF...), e.g. alarm_volt 0xFFFF is a permanent alarm. Writes the defaults of the settings
+// added since the stored layout step by step, the settings already there are kept.
+void check_settings()
+{
+	uint8_t layout = eeprom_read_byte(&settings_layout);
+	
+	if (layout == SETTINGS_LAYOUT)
+	{
+		return;
+	}
+	
+	log_serial_P(PSTR("EEPROM layout changed, writing defaults of the new settings...\r\n"));
+	
+	switch (layout)
+	{
+		default:
+		case 0xFF: // v1.4 or erased, everything after daily_confirmed_uplinks added
+		{
+			eeprom_update_dword(&la_baud, LA66_BAUD);
+			eeprom_update_word(&rbe_fence_delta, RBE_FENCE_DELTA);
+			eeprom_update_word(&rbe_bat_delta, RBE_BATTERY_DELTA);
+			eeprom_update_byte(&rbe_heartbeat, RBE_HEARTBEAT_CYCLES);
+			eeprom_update_word(&alarm_volt, ALARM_VOLTAGE);
+			eeprom_update_word(&alarm_interval, ALARM_CHECK_INTERVAL);
+			eeprom_update_byte(&alarm_confirm, ALARM_CONFIRM);
+			eeprom_update_word(&msr_interval, MEASURE_INTERVAL);
+			eeprom_update_byte(&settings_legacy, SETTINGS_LEGACY);
+			eeprom_update_word(&airtime_day, AIRTIME_DAY_BUDGET);
+			eeprom_update_byte(&link_adapt, LINK_ADAPT);
+			eeprom_update_word((uint16_t *)&clock_drift, 0);
+		}
+		// fall through
+		case 1: // tdc_min and tdc_max added
+		{
+			eeprom_update_dword(&tdc_min, TDC_MIN);
+			eeprom_update_dword(&tdc_max, TDC_MAX);
+		}
+	}
+	
+	eeprom_update_byte(&settings_layout, SETTINGS_LAYOUT);
+}
+
 // ----------------------------------------------------------------------------------------------
 
 int main(void)
@@ -693,7 +2941,7 @@ int main(void)
 	LED_TX_set_level(true);
 
 	log_serial_P(PSTR("\r\n"));
-	log_serial_P(PSTR("LoFence-V2 v1.4 by Alex9779\r\n"));
+	log_serial_P(PSTR("LoFence-V2 v1.5 by Alex9779\r\n"));
 	log_serial_P(PSTR("https://github.com/Alex9779/LoFence\r\n"));
 	log_serial_P(PSTR("\r\n"));
 
@@ -706,18 +2954,42 @@ int main(void)
 
 	seed_rand();
 	adc_init();	
+	
+	check_settings();
+	
+	// a corrupted value must not detune the clock
+	int16_t ppm = eeprom_read_word((uint16_t *)&clock_drift);
+	
+	drift_ppm = MAX(MIN(ppm, CLOCK_DRIFT_MAX), -CLOCK_DRIFT_MAX);
+	
+	// the first measurement is taken while waiting for the join
+	measure_start(MSR_BATTERY | MSR_FENCES);
 	reset_join();
 	
 	while (1)
 	{
+		if (time_align)
+		{
+			align_time();
+		}
+		
 		if (day_seconds >= 86400)
 		{
-			day_seconds = 0;
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+			{
+				day_seconds -= 86400;
+			}
+			
 			daily_cycle_count = 0;
 			daily_confirmed_uplink_count = 0;
+			diagnostics = true;
 		}
 
+		update_profile();
+		
 		cycle_start_day_seconds = day_seconds;
+		cycle_airtime = 0;
+		cycle_failed = false;
 		
 		daily_cycle_count++;
 		
@@ -726,38 +2998,140 @@ int main(void)
 		{
 			volt_bat = 0;
 
-			// try to transmit data confirmed
-			transmit_data(true);
+			if (joined)
+			{
+				radio_wakeup();
+
+				// try to transmit data confirmed
+				transmit_data(true);
+			}
 			
 			deactivate();
 		}
 		
-		// if previous cycle threw an error
-		if (last_error != 0)
+		// an error in the previous cycle requires a rejoin
+		if (last_error != 0 && joined)
+		{
+			if (rejoin_count < 0xFF) rejoin_count++;
+			failed_transmissions = 0;
+			
+			joined = false;
+			join_backoff_seconds = 0;
+		}
+		
+		if (!joined && join_backoff_seconds == 0)
 		{
+			measure_start(MSR_BATTERY | MSR_FENCES);
 			reset_join();
+		}
+		
+		// not joined, keep monitoring the fence locally
+		if (!joined)
+		{
+			log_serial_P(PSTR("Not joined, monitoring only...\r\n"));
 			
+			measure();
+		}
+		// if previous cycle threw an error
+		else if (last_error != 0)
+		{
 			transmit_error(true);
 			
 			last_error = 0;
 		}
+		// legacy settings part requested
+		else if (settings > 0 && settings < SETTINGS_ALL)
+		{
+			radio_wakeup();
+			
+			transmit_settings(false);
+
+			daily_cycle_count--;
+		}
 		// normal cycle
-		else if (settings == 0)
+		else
 		{
 			handle_daily_settings();
 			
-			measure();
+			// pipelined cycle: only the fences are measured up front, the battery is measured while
+			// the LA66 waits for the receive windows and its voltage is sent with the next uplink
+			bool pipelined = !msr_fresh && volt_bat > 0;
+			
+			if (pipelined)
+			{
+				measure_start(MSR_FENCES);
+				measure_finish();
+			}
+			else
+			{
+				measure();
+			}
+			
+			bool confirm = get_uplink_confirmation();
+			
+			if (pipelined)
+			{
+				measure_start(MSR_BATTERY);
+			}
+			
+			if (batch_count > 1)
+			{
+				radio_wakeup();
+				
+				transmit_batch(confirm);
+				
+				// once a day right after normal data while the LA66 is awake anyway
+				if (diagnostics && last_error == 0 && get_airtime_remaining() >= AIRTIME_RESERVE)
+				{
+					transmit_diagnostics(false);
+				}
+			}
+			else if (confirm || get_report_required())
+			{
+				batch_count = 0;
+				
+				radio_wakeup();
+				
+				transmit_data(confirm);
+				
+				// once a day right after normal data while the LA66 is awake anyway
+				if (diagnostics && last_error == 0 && get_airtime_remaining() >= AIRTIME_RESERVE)
+				{
+					transmit_diagnostics(false);
+				}
+			}
+			else
+			{
+				log_serial_P(PSTR("Values unchanged, skipping uplink...\r\n"));
+			}
 			
-			transmit_data(get_uplink_confirmation());
+			// all settings or the profiles in one uplink right after normal data, no extra cycle needed,
+			// deferred to a later cycle if the airtime budget is almost used up
+			if (settings >= SETTINGS_ALL && last_error == 0 && get_airtime_remaining() >= AIRTIME_RESERVE)
+			{
+				radio_wakeup();
+				
+				transmit_settings(false);
+			}
 		}
-		// settings requested
-		else
+
+		// network time sync while the LA66 is awake anyway
+		if (joined && last_error == 0 && !LA66_is_sleeping() && get_time_sync_due() && get_airtime_remaining() >= AIRTIME_RESERVE)
 		{
-			transmit_settings(false);
+			sync_time();
+		}
 
-			daily_cycle_count--;
+		// acknowledge a multi command downlink in the same cycle
+		if (config_ack && joined && last_error == 0)
+		{
+			radio_wakeup();
+			
+			transmit_config_ack(false);
 		}
 
+		// the battery measurement may still be running if there was no uplink
+		measure_finish();
+
 		#ifndef WORKBENCH
 		check_battery();
 		#endif
@@ -1,7 +1,7 @@
 #ifndef MAIN_H_
 #define MAIN_H_
 
-#define VERSION 14
+#define VERSION 15
 
 // time to sleep between measurements
 #define INTERVAL_SECONDS 5 * 60
@@ -9,6 +9,45 @@
 // amount of uplink to send confirmed per day
 #define DAILY_CONFIRMED_UPLINKS 1
 
+// shortest tdc in s accepted by downlink (also tdc_min and the tdc of profiles),
+// a cycle with a join or several uplinks takes longer than shorter intervals
+#define TDC_LOWEST 30
+
+// shortest time in s to sleep after a cycle which took longer than the interval
+#define CYCLE_MIN_SLEEP 10
+
+// adaptive tdc: shortest time in s to sleep between measurements
+// while the fence is faulty or recovering
+#define TDC_MIN 60
+
+// adaptive tdc: longest time in s to sleep between measurements,
+// 0 disables the adaptive tdc
+#define TDC_MAX 0
+
+// adaptive tdc: time in s after a fence recovery the shortest interval is kept
+#define TDC_RECOVERY_SECONDS 60 * 60
+
+// adaptive tdc: time in s the fence has to be stable to double the interval,
+// doubled again for each further period
+#define TDC_STABLE_SECONDS 6UL * 60 * 60
+
+// adaptive tdc: battery voltage margin in mV above the battery low threshold
+// within which the interval is stretched towards the longest one
+#define TDC_BATTERY_MARGIN 300
+
+// time-of-day profiles: amount of entries in the profile table,
+// the profiles uplink (see codec_profiles) holds 4
+#define PROFILE_COUNT 4
+
+// time-of-day profiles: start of an unused entry (erased EEPROM)
+#define PROFILE_UNUSED 0xFFFF
+
+// time-of-day profiles: confirmed uplink policy, daily_confirmed_uplinks
+// spread over the day, no confirmed uplinks or every uplink confirmed
+#define PROFILE_CONFIRM_DAILY 0
+#define PROFILE_CONFIRM_NONE 1
+#define PROFILE_CONFIRM_ALL 2
+
 // +- time to sleep between measurements in s
 #define RANDOMNESS 5
 
@@ -20,6 +59,150 @@
 // time in ms a measurement should take (per polarity)
 #define MEASURE_MS 6000
 
+// baud rate of the UART link to the LA66,
+// falls back to 9600 if the LA66 does not work with it
+#define LA66_BAUD 38400
+
+// time in s to wait for a join per attempt
+#define JOIN_ATTEMPT_TIMEOUT 3 * 60
+
+// backoff in s after the first failed join attempt,
+// doubled with each failed attempt up to JOIN_BACKOFF_MAX, +-25% jitter
+#define JOIN_BACKOFF_BASE 5 * 60
+
+// maximum backoff in s between join attempts
+#define JOIN_BACKOFF_MAX 6UL * 60 * 60
+
+// amount of retries within a cycle if all channels are busy
+#define TX_BUSY_RETRIES 3
+
+// base backoff in s before retrying a busy transmission,
+// doubled with each retry plus random part of the same size
+#define TX_BUSY_BACKOFF 4
+
+// amount of subsequent cycles with failed transmission
+// before the LA66 is reset and rejoins the network
+#define RECOVERY_REJOIN_FAILURES 3
+
+// report by exception: minimum change of a fence voltage in V
+// since the last uplink to send an uplink, 0 sends every cycle
+#define RBE_FENCE_DELTA 0
+
+// report by exception: minimum change of the battery voltage in mV
+// since the last uplink to send an uplink
+#define RBE_BATTERY_DELTA 100
+
+// report by exception: an uplink is sent at least every n cycles
+#define RBE_HEARTBEAT_CYCLES 12
+
+// fence alarm: fence voltage in V below which an alarm uplink
+// is sent right away while sleeping, 0 disables monitoring
+#define ALARM_VOLTAGE 0
+
+// fence alarm: interval in s between fence checks while sleeping
+#define ALARM_CHECK_INTERVAL 60
+
+// fence alarm: send alarm and recovery uplinks confirmed
+#define ALARM_CONFIRM 0
+
+// fence alarm: minimum time in s between alarm or recovery uplinks
+#define ALARM_MIN_INTERVAL 10 * 60
+
+// fence alarm: settle time in ms after powering the measurement
+// circuit and time in ms to sample a pole, must cover a fence pulse
+#define ALARM_SETTLE_MS 500
+#define ALARM_SAMPLE_MS 1500
+
+// airtime: regulatory duty cycle budget in ms per rolling hour,
+// 1% of the g1 sub-band in EU868
+#define AIRTIME_HOUR_BUDGET 36000
+
+// airtime: fair use budget in s per rolling day, 0 disables
+#define AIRTIME_DAY_BUDGET 0
+
+// airtime: settings and diagnostics uplinks are deferred
+// if less airtime in ms than this remains in the budgets
+#define AIRTIME_RESERVE 5000
+
+// link adaption: lower the TX power and the amount of confirmed uplinks
+// if the link margin allows it
+#define LINK_ADAPT 1
+
+// link adaption: link margin in dB above which the TX power is lowered
+// and confirmed uplinks are halved
+#define LINK_MARGIN_HIGH 15
+
+// link adaption: link margin in dB below which the TX power is raised
+#define LINK_MARGIN_LOW 6
+
+// link adaption: highest TX power index (lowest power), each index reduces the EIRP by 2 dB
+#define TX_POWER_MAX_INDEX 5
+
+// time sync: first interval in s between network time syncs,
+// doubled after each sync within tolerance
+#define TIME_SYNC_MIN_INTERVAL 6UL * 60 * 60
+
+// time sync: maximum interval in s between network time syncs
+#define TIME_SYNC_MAX_INTERVAL 7UL * 24 * 60 * 60
+
+// time sync: clock error in s up to which the sync interval is doubled
+#define TIME_SYNC_TOLERANCE 2
+
+// time sync: maximum clock drift correction in ppm
+#define CLOCK_DRIFT_MAX 500
+
+// transmit slots: payload size in bytes and DR the slot width is derived from,
+// fixed so the slots do not move with the DR (DR0 gives the widest slots)
+#define TX_SLOT_PAYLOAD 6
+#define TX_SLOT_DR 0
+
+// transmit slots: guard in ms added to the airtime, covers the timing jitter of a cycle
+// (wakeup, measurement and the whole seconds of the network time)
+#define TX_SLOT_GUARD_MS 1000
+
+// transmit slots: interval in s after which the slot of a device is drawn anew
+#define TX_SLOT_RESEED 7UL * 24 * 60 * 60
+
+// seconds per TIMER2 period with prescaler 1024 while sleeping,
+// the timer runs in 1 s periods otherwise
+#define TICK_LONG 8
+
+// energy accounting: estimated average current in uA of the whole device per phase,
+// calibrate with a measurement of the actual hardware
+#define ENERGY_AWAKE_UA 3000 // MCU active or idle, LA66 idle
+#define ENERGY_SLEEP_UA 10 // MCU power save, LA66 sleeping
+#define ENERGY_BOOT_UA 5000 // start up until the first join
+#define ENERGY_JOIN_UA 12000 // LA66 joining, TX and RX windows averaged in
+#define ENERGY_SETTLE_UA 4000 // measurement circuit settling, battery measurement
+#define ENERGY_FENCE_UA 4000 // ADC sampling a fence pole
+#define ENERGY_TX_UA 45000 // LA66 transmitting (time on air)
+#define ENERGY_RX_UA 10000 // LA66 waiting for and in the receive windows
+#define ENERGY_LOG_UA 3000 // MCU writing the debug log
+
+// settings uplinks: 0 sends all settings in one uplink,
+// 1 sends the three legacy uplinks on fPorts 2, 3 and 4
+#define SETTINGS_LEGACY 0
+
+// settings value requesting all settings in one uplink
+#define SETTINGS_ALL 4
+
+// settings value requesting the time-of-day profiles
+#define SETTINGS_PROFILES 5
+
+// amount of settings in the single settings uplink, see read_settings()
+#define SETTINGS_COUNT 19
+
+// layout of the EEPROM settings, increase when settings are appended and add a step
+// to check_settings(), an update preserving the EEPROM then writes the defaults of the added settings
+#define SETTINGS_LAYOUT 2
+
+// measurement batching: interval in s between measurements
+// within a cycle, 0 measures once per cycle
+#define MEASURE_INTERVAL 0
+
+// measurement batching: maximum amount of samples per uplink
+#define BATCH_MAX_SAMPLES 16
+
 // battery low threshold voltage in mV
 #define BATTERY_LOW_THRESHOLD 3200
 
@@ -31,6 +214,16 @@
 // which triggers deactivation right away (next cycle)
 #define BATTERY_ABSOLUTE_MINIMUM 3100
 
+// time-of-day profile, applies from start (minutes after midnight UTC) until the next profile starts,
+// a tdc or msr_ms of 0 keeps the setting
+typedef struct profile
+{
+	uint16_t start;
+	uint32_t tdc;
+	uint16_t msr_ms;
+	uint8_t confirm;
+} profile;
+
 void log_serial(const char *msg);
 void log_serial_P(const char *msg);
 
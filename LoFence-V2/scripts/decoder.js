@@ -0,0 +1,188 @@
+// Reference payload decoder for LoFence-V2 uplinks (ChirpStack v4 / TTN v3).
+// The schemas must match include/codec.h and src/codec.c of the firmware.
+
+var FENCE_STEP = 4;
+
+// Reads fields of the given bit widths MSB first.
+function unpack(bytes, widths) {
+  var values = [];
+  var pos = 0;
+
+  for (var i = 0; i < widths.length; i++) {
+    var value = 0;
+
+    for (var b = 0; b < widths[i]; b++, pos++) {
+      var bit = (bytes[pos >> 3] >> (7 - (pos & 7))) & 1;
+      value = value * 2 + bit;
+    }
+
+    values.push(value);
+  }
+
+  return values;
+}
+
+function decodeData(bytes) {
+  var hasVersion = (bytes[0] & 0x80) !== 0;
+  var v = unpack(bytes, hasVersion ? [1, 12, 12, 12, 8] : [1, 12, 12, 12]);
+  var data = {
+    volt_bat: v[1],
+    volt_fence_plus: v[2] * FENCE_STEP,
+    volt_fence_minus: v[3] * FENCE_STEP
+  };
+
+  if (hasVersion) {
+    data.version = v[4];
+  }
+
+  return data;
+}
+
+function unzigzag(value) {
+  return (value & 1) ? -((value + 1) >> 1) : value >> 1;
+}
+
+// Batch of samples, first absolute then zigzag encoded deltas to the previous sample.
+function decodeBatch(bytes) {
+  var h = unpack(bytes, [4, 4, 16, 12, 12, 12]);
+  var count = h[0] + 1;
+  var width = h[1];
+  var widths = [4, 4, 16, 12, 12, 12];
+  var plus = h[4];
+  var minus = h[5];
+  var samples = [{ volt_fence_plus: plus * FENCE_STEP, volt_fence_minus: minus * FENCE_STEP }];
+
+  for (var i = 1; i < count; i++) {
+    widths.push(width, width);
+  }
+
+  var v = unpack(bytes, widths);
+
+  for (i = 1; i < count; i++) {
+    plus += unzigzag(v[4 + i * 2]);
+    minus += unzigzag(v[5 + i * 2]);
+    samples.push({ volt_fence_plus: plus * FENCE_STEP, volt_fence_minus: minus * FENCE_STEP });
+  }
+
+  return { interval: h[2], volt_bat: h[3], samples: samples };
+}
+
+// CRC-16/XMODEM over all settings, each as 4 bytes big endian (see get_config_crc()).
+function configCrc(values) {
+  var crc = 0;
+
+  for (var i = 0; i < values.length; i++) {
+    for (var shift = 24; shift >= 0; shift -= 8) {
+      crc ^= ((values[i] >>> shift) & 0xFF) << 8;
+
+      for (var b = 0; b < 8; b++) {
+        crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) & 0xFFFF : (crc << 1) & 0xFFFF;
+      }
+    }
+  }
+
+  return crc;
+}
+
+var SETTINGS = ["tdc", "daily_confirmed_uplinks", "max_volt", "msr_ms", "bat_low", "bat_low_count_max", "bat_low_min",
+  "la_baud", "rbe_fence_delta", "rbe_bat_delta", "rbe_heartbeat", "alarm_volt", "alarm_interval", "alarm_confirm",
+  "msr_interval", "airtime_day", "link_adapt", "tdc_min", "tdc_max"];
+
+function decodeSettings(bytes) {
+  var v = unpack(bytes, [8, 24, 8, 14, 16, 12, 8, 12, 24, 16, 12, 8, 14, 16, 1, 16, 16, 1, 24, 24, 16]);
+  var data = { version: v[0] };
+
+  for (var i = 0; i < SETTINGS.length; i++) {
+    data[SETTINGS[i]] = v[i + 1];
+  }
+
+  data.config_crc = v[SETTINGS.length + 1];
+  data.config_crc_valid = configCrc(v.slice(1, SETTINGS.length + 1)) === data.config_crc;
+
+  return data;
+}
+
+function decodeUplink(input) {
+  var bytes = input.bytes;
+  var v;
+
+  switch (input.fPort) {
+    case 1:
+      return { data: decodeData(bytes) };
+
+    case 2:
+      v = unpack(bytes, [8, 24, 8]);
+      return { data: { version: v[0], tdc: v[1], daily_confirmed_uplinks: v[2] } };
+
+    case 3:
+      v = unpack(bytes, [8, 14, 16]);
+      return { data: { version: v[0], max_volt: v[1], msr_ms: v[2] } };
+
+    case 4:
+      v = unpack(bytes, [8, 12, 8, 12]);
+      return { data: { version: v[0], bat_low: v[1], bat_low_count_max: v[2], bat_low_min: v[3] } };
+
+    case 5:
+      v = unpack(bytes, [1, 12, 12]);
+      return { data: { alarm: v[0] === 1, volt_fence_plus: v[1] * FENCE_STEP, volt_fence_minus: v[2] * FENCE_STEP } };
+
+    case 6:
+      return { data: decodeBatch(bytes) };
+
+    case 7:
+      return { data: decodeSettings(bytes) };
+
+    case 8:
+      v = unpack(bytes, [8, 8, 16]);
+      return { data: { status: v[0], applied: v[1], config_crc: v[2] } };
+
+    case 9:
+      v = unpack(bytes, [8, 11, 24, 16, 2, 11, 24, 16, 2, 11, 24, 16, 2, 11, 24, 16, 2]);
+      var profiles = [];
+
+      // unused entries have a start of 2047
+      for (var p = 0; p < 4; p++) {
+        if (v[1 + p * 4] < 1440) {
+          profiles.push({
+            index: p, start_minutes: v[1 + p * 4], tdc: v[2 + p * 4], msr_ms: v[3 + p * 4],
+            confirm: ["daily", "none", "all"][v[4 + p * 4]]
+          });
+        }
+      }
+
+      return { data: { version: v[0], profiles: profiles } };
+
+    case 222:
+      v = unpack(bytes, [16, 8, 16, 8, 8, 8, 8, 3, 16, 16, 10, 1, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14]);
+      var diagnostics = {
+        busy_events: v[0], busy_lost: v[1], airtime_day_ms: v[2] * 100, link_samples: v[3],
+        rssi: -v[4], snr: v[5] - 128, link_margin: v[6] - 128, tx_power_index: v[7],
+        param_hits: v[8], param_misses: v[9], clock_drift_ppm: v[10] - 512, time_synced: v[11] === 1
+      };
+
+      // charge per phase in 10 uAh
+      var phases = ["awake", "sleep", "boot", "join", "settle", "fence_plus", "fence_minus", "tx", "rx", "log"];
+      var total = 0;
+
+      diagnostics.charge_mah = {};
+
+      for (var i = 0; i < phases.length; i++) {
+        diagnostics.charge_mah[phases[i]] = v[12 + i] / 100;
+        total += v[12 + i];
+      }
+
+      diagnostics.charge_mah.total = total / 100;
+
+      return { data: diagnostics };
+
+    case 223:
+      v = unpack(bytes, [8, 8, 8, 8]);
+      return { data: { error: v[0], busy_retries: v[1], resyncs: v[2], rejoins: v[3] } };
+  }
+
+  return { errors: ["unknown fPort " + input.fPort] };
+}
+
+if (typeof module !== "undefined") {
+  module.exports = { decodeUplink: decodeUplink };
+}
@@ -0,0 +1,190 @@
+// Collision simulation of random jitter against transmit slots (see get_slot_wait() in main.c).
+// Usage: node slot_sim.js [tdc] [dr] [cycles]
+//
+// Each device sends one uplink per cycle on one of the default channels, two uplinks
+// collide if they overlap on the same channel (no capture effect). Without time sync
+// every cycle lasts tdc +- RANDOMNESS s, with time sync a device starts at its slot
+// in the network time grid plus the timing jitter of a cycle. The slot is either drawn
+// anew every cycle or kept per device, reseeded weekly and rotated when a confirmed
+// uplink lost its acknowledgement (a detected collision).
+
+var RANDOMNESS = 5;
+var SLOT_DR = 0; // TX_SLOT_DR, the slot width does not depend on the current DR
+var CHANNELS = 3;
+var TIMING_JITTER = 1; // s, wakeup, measurement and remaining clock error
+var SLOT_GUARD = 1; // TX_SLOT_GUARD_MS / 1000, covers the timing jitter
+var RESEED = 7 * 86400; // TX_SLOT_RESEED
+var CONFIRMED_PER_DAY = 1; // DAILY_CONFIRMED_UPLINKS, the only uplinks a collision is detected by
+var FLEET_SIZES = [10, 25, 50, 100, 200, 500, 1000];
+
+var tdc = parseInt(process.argv[2] || "300", 10);
+var dr = parseInt(process.argv[3] || "0", 10);
+var cycles = parseInt(process.argv[4] || "200", 10);
+
+// Same as LA66_getAirtime(), the slot width is derived from the 6 byte data uplink.
+function airtime(dr, size) {
+  var length = size + 13;
+  var sf = 12 - Math.min(dr, 5);
+  var symbol = (dr === 6 ? 4 : 8) * Math.pow(2, sf) / 1000000;
+  var bitsPerSymbol = 4 * (sf >= 11 && dr < 6 ? sf - 2 : sf);
+  var payloadBits = 8 * length - 4 * sf + 28 + 16;
+  var symbols = 8 + (payloadBits > 0 ? Math.ceil(payloadBits / bitsPerSymbol) * 5 : 0);
+
+  return (12.25 + symbols) * symbol;
+}
+
+// Same as get_device_hash() in main.c.
+function deviceHash(serial, salt) {
+  var hash = 2166136261;
+
+  for (var i = 0; i < serial.length; i++) {
+    hash = Math.imul(hash ^ serial[i], 16777619) >>> 0;
+  }
+
+  for (i = 0; i < 32; i += 8) {
+    hash = Math.imul(hash ^ ((salt >>> i) & 0xFF), 16777619) >>> 0;
+  }
+
+  return hash;
+}
+
+function randomSerial() {
+  var serial = [];
+
+  for (var i = 0; i < 10; i++) {
+    serial.push(Math.floor(Math.random() * 256));
+  }
+
+  return serial;
+}
+
+function collisionRate(frames, duration) {
+  var collided = 0;
+
+  frames.sort(function (a, b) { return a.start - b.start; });
+
+  for (var i = 0; i < frames.length; i++) {
+    for (var j = i + 1; j < frames.length && frames[j].start < frames[i].start + duration; j++) {
+      if (frames[j].channel === frames[i].channel) {
+        frames[i].collided = true;
+        frames[j].collided = true;
+      }
+    }
+
+    if (frames[i].collided) {
+      collided++;
+    }
+  }
+
+  return collided / frames.length;
+}
+
+// start spread is the time window in which the devices started, tdc for independent devices,
+// a few seconds for a fleet which rejoined at once after an outage.
+function simulateRandom(devices, duration, spread) {
+  var frames = [];
+
+  for (var d = 0; d < devices; d++) {
+    var t = Math.random() * spread;
+
+    for (var c = 0; c < cycles; c++) {
+      frames.push({ start: t, channel: Math.floor(Math.random() * CHANNELS) });
+      t += tdc + Math.floor(Math.random() * RANDOMNESS * 2) - RANDOMNESS;
+    }
+  }
+
+  return collisionRate(frames, duration);
+}
+
+// Slot width in ms and count as in get_slot_wait(), starts are whole seconds of the network time.
+function slotWidth() {
+  return Math.ceil((airtime(SLOT_DR, 6) + SLOT_GUARD) * 1000);
+}
+
+function slotStart(c, slot, width) {
+  return c * tdc + Math.floor(slot * width / 1000) + Math.random() * TIMING_JITTER;
+}
+
+function simulateSlots(devices, duration) {
+  var frames = [];
+  var width = slotWidth();
+  var slots = Math.floor(tdc * 1000 / width);
+
+  for (var d = 0; d < devices; d++) {
+    var serial = randomSerial();
+
+    for (var c = 1; c <= cycles; c++) {
+      frames.push({ start: slotStart(c, deviceHash(serial, c) % slots, width), channel: Math.floor(Math.random() * CHANNELS) });
+    }
+  }
+
+  return collisionRate(frames, duration);
+}
+
+// The collisions are only known after a cycle, so the fleet is simulated cycle by cycle.
+function simulatePersistent(devices, duration) {
+  var width = slotWidth();
+  var slots = Math.floor(tdc * 1000 / width);
+  var confirmEvery = Math.max(Math.round(86400 / tdc / CONFIRMED_PER_DAY), 1);
+  var fleet = [];
+  var collided = 0;
+
+  for (var d = 0; d < devices; d++) {
+    fleet.push({ serial: randomSerial(), rotations: 0, phase: Math.floor(Math.random() * confirmEvery) });
+  }
+
+  for (var c = 1; c <= cycles; c++) {
+    var period = Math.floor(c * tdc / RESEED);
+    var frames = fleet.map(function (device) {
+      var salt = (period | (device.rotations << 24)) >>> 0;
+
+      return { device: device, start: slotStart(c, deviceHash(device.serial, salt) % slots, width), channel: Math.floor(Math.random() * CHANNELS) };
+    });
+
+    // frames of the neighbouring cycles cannot overlap, the cycle is far longer than a frame
+    collisionRate(frames, duration);
+
+    frames.forEach(function (frame) {
+      if (frame.collided) {
+        collided++;
+
+        if ((c + frame.device.phase) % confirmEvery === 0) {
+          frame.device.rotations = (frame.device.rotations + 1) & 0xFF;
+        }
+      }
+    });
+  }
+
+  return collided / (devices * cycles);
+}
+
+var duration = airtime(dr, 6);
+
+console.log("tdc " + tdc + " s, DR" + dr + ", airtime " + (duration * 1000).toFixed(0) + " ms, " + CHANNELS + " channels, " + cycles + " cycles, slot " + slotWidth() + " ms");
+console.log("devices  random  common start  slots per cycle  slots per device  ALOHA theory");
+
+// small fleets are simulated several times, their rates depend a lot on the drawn serials
+function average(simulate, devices) {
+  var runs = Math.max(Math.round(1000 / devices), 1);
+  var sum = 0;
+
+  for (var r = 0; r < runs; r++) {
+    sum += simulate();
+  }
+
+  return sum / runs;
+}
+
+FLEET_SIZES.forEach(function (devices) {
+  var load = devices * duration / (tdc * CHANNELS);
+  var theory = 1 - Math.exp(-2 * load);
+
+  console.log(
+    String(devices).padStart(7) + "  " +
+    (average(function () { return simulateRandom(devices, duration, tdc); }, devices) * 100).toFixed(2).padStart(5) + "%  " +
+    (average(function () { return simulateRandom(devices, duration, 10); }, devices) * 100).toFixed(2).padStart(11) + "%  " +
+    (average(function () { return simulateSlots(devices, duration); }, devices) * 100).toFixed(2).padStart(15) + "%  " +
+    (average(function () { return simulatePersistent(devices, duration); }, devices) * 100).toFixed(2).padStart(16) + "%  " +
+    (theory * 100).toFixed(2).padStart(12) + "%"
+  );
+});
@@ -0,0 +1,95 @@
+/*!
+@file	codec.c
+@brief	Schema driven bit packing of uplink payloads.
+
+@see codec.h
+*/
+
+#include "codec.h"
+
+const uint8_t codec_data[] PROGMEM = { 4, 1, 12, 12, 12 };
+const uint8_t codec_data_version[] PROGMEM = { 5, 1, 12, 12, 12, 8 };
+const uint8_t codec_settings_1[] PROGMEM = { 3, 8, 24, 8 };
+const uint8_t codec_settings_2[] PROGMEM = { 3, 8, 14, 16 };
+const uint8_t codec_settings_3[] PROGMEM = { 4, 8, 12, 8, 12 };
+const uint8_t codec_alarm[] PROGMEM = { 3, 1, 12, 12 };
+const uint8_t codec_settings[] PROGMEM = { 21, 8, 24, 8, 14, 16, 12, 8, 12, 24, 16, 12, 8, 14, 16, 1, 16, 16, 1, 24, 24, 16 };
+const uint8_t codec_profiles[] PROGMEM = { 17, 8, 11, 24, 16, 2, 11, 24, 16, 2, 11, 24, 16, 2, 11, 24, 16, 2 };
+const uint8_t codec_config_ack[] PROGMEM = { 3, 8, 8, 16 };
+const uint8_t codec_diagnostics[] PROGMEM = { 22, 16, 8, 16, 8, 8, 8, 8, 3, 16, 16, 10, 1, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14 };
+const uint8_t codec_error[] PROGMEM = { 4, 8, 8, 8, 8 };
+
+// Writes a byte as two hex chars.
+static char *write_hex(char *hex, uint8_t byte)
+{
+	static const char digits[] PROGMEM = "0123456789ABCDEF";
+	
+	*hex++ = pgm_read_byte(&digits[byte >> 4]);
+	*hex++ = pgm_read_byte(&digits[byte & 0x0F]);
+	
+	return hex;
+}
+
+void codec_begin(codec_writer *writer, char *hex)
+{
+	writer->hex = hex;
+	writer->bytes = 0;
+	writer->acc = 0;
+	writer->used = 0;
+	
+	*hex = '\0';
+}
+
+uint32_t codec_clamp(uint32_t value, uint8_t bits)
+{
+	uint32_t max = bits >= 32 ? 0xFFFFFFFF : ((uint32_t)1 << bits) - 1;
+	
+	return value > max ? max : value;
+}
+
+void codec_put(codec_writer *writer, uint32_t value, uint8_t bits)
+{
+	value = codec_clamp(value, bits);
+	
+	while (bits--)
+	{
+		writer->acc = (writer->acc << 1) | ((value >> bits) & 1);
+		
+		if (++writer->used == 8)
+		{
+			writer->hex = write_hex(writer->hex, writer->acc);
+			writer->bytes++;
+			writer->acc = 0;
+			writer->used = 0;
+		}
+	}
+}
+
+uint8_t codec_end(codec_writer *writer)
+{
+	if (writer->used > 0)
+	{
+		writer->hex = write_hex(writer->hex, writer->acc << (8 - writer->used));
+		writer->bytes++;
+		writer->used = 0;
+	}
+	
+	*writer->hex = '\0';
+	
+	return writer->bytes;
+}
+
+uint8_t codec_encode(char *hex, const uint8_t *schema, const uint32_t *values)
+{
+	codec_writer writer;
+	uint8_t count = pgm_read_byte(&schema[0]);
+	
+	codec_begin(&writer, hex);
+	
+	for (uint8_t i = 0; i < count; i++)
+	{
+		codec_put(&writer, values[i], pgm_read_byte(&schema[i + 1]));
+	}
+	
+	return codec_end(&writer);
+}
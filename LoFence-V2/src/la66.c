@@ -17,6 +17,19 @@
 char debug[32 + LA66_MAX_BUFF];
 #endif
 
+static bool sleeping = false;
+static uint8_t dr_uplinks = 0;
+static uint8_t tx_count = 0;
+static bool transmitting = false;
+static uint8_t tx_serial = 0;
+static LA66_Params params;
+static uint8_t params_valid = 0;
+static uint16_t params_hits = 0;
+static uint16_t params_misses = 0;
+static int16_t link_rssi = 0;
+static int8_t link_snr = 0;
+static bool link_new = false;
+
 //===========
 // FUNCTIONS
 //===========
@@ -39,12 +52,11 @@ static void readHex(char* buf, char* txt)
 // while there is data, return null char if not
 static char read(const bool wait)
 {
-	uint16_t timeout = 100;
-
-	// wait for data to be available
-	while (!USART_0_is_rx_ready() && wait && timeout--)
+	// wait up to 100ms for data to be available, the MCU idles until a byte is received,
+	// no tasks run this deep in the call stack
+	if (wait)
 	{
-		_delay_ms(1);
+		idle_until(USART_0_is_rx_ready, 100);
 	}
 
 	if (USART_0_is_rx_ready())
@@ -75,7 +87,7 @@ static void clear_read()
 		while(USART_0_is_rx_ready()) {
 			USART_0_read();
 		}
-		_delay_ms(100);
+		idle_until(USART_0_is_rx_ready, 100);
 	}
 }
 
@@ -130,6 +142,13 @@ static uint8_t read_line(char *line)
 	return i;
 }
 
+// Marks that a transmission of the LA66 might be on air until its txDone.
+static void tx_begin()
+{
+	transmitting = true;
+	tx_serial++;
+}
+
 // Sends a command to the LA66.
 // No response is read.
 static LA66_ReturnCode send_command(const char *command)
@@ -153,17 +172,116 @@ static LA66_ReturnCode send_command(const char *command)
 	// send command
 	write(command);
 	
-	_delay_ms(10);
+	idle_until(NULL, 10);
 	
 	return LA66_SUCCESS;
 }
 
+// Maps an error response line of the LA66 to a return code.
+// Returns LA66_SUCCESS if line is not an error response.
+static LA66_ReturnCode check_error(const char *line)
+{
+	if (strcmp_P(line, PSTR(AT_ERROR)) == 0)
+	{
+		return LA66_ERROR;
+	}
+	else if (strcmp_P(line, PSTR(AT_PARAM_ERROR)) == 0)
+	{
+		return LA66_ERR_PARAM;
+	}
+	else if (strcmp_P(line, PSTR(AT_BUSY_ERROR)) == 0)
+	{
+		return LA66_ERR_BUSY;
+	}
+	else if (strcmp_P(line, PSTR(AT_NO_NET_JOINED)) == 0)
+	{
+		return LA66_ERR_JOIN;
+	}
+	
+	return LA66_SUCCESS;
+}
+
+// Sends a command to the LA66 which is only answered with OK or an error.
+// Waits timeout * 10ms for the answer.
+static LA66_ReturnCode command(const char *command, uint16_t timeout)
+{
+	LA66_ReturnCode ret = LA66_ERR_PANIC;
+	LA66_buffer response;
+	
+	if (send_command(command) == LA66_SUCCESS)
+	{
+		for (uint16_t i = 0; i < timeout; i++)
+		{
+			if (read_line(response) > 0)
+			{
+				if (strcmp_P(response, PSTR(AT_OK)) == 0)
+				{
+					ret = LA66_SUCCESS;
+					break;
+				}
+				
+				ret = check_error(response);
+				
+				if (ret != LA66_SUCCESS)
+				{
+					break;
+				}
+				
+				ret = LA66_ERR_PANIC;
+			}
+			
+			idle_until(USART_0_is_rx_ready, 10);
+		}
+	}
+	
+	return ret;
+}
+
+// As command() with the command in program memory.
+static LA66_ReturnCode command_P(const char *pgm_command, uint16_t timeout)
+{
+	char rCommand[strlen_P(pgm_command) + 1];
+	
+	strcpy_P(rCommand, pgm_command);
+	
+	return command(rCommand, timeout);
+}
+
+// Parses reception quality output of the LA66 like "Rssi= -47" or "RSSI= -47, SNR= 9".
+static void parse_link(const char *line)
+{
+	const char *value;
+	
+	if ((value = strstr_P(line, PSTR("ssi="))) || (value = strstr_P(line, PSTR("SSI="))))
+	{
+		link_rssi = atoi(value + 4);
+		link_new = true;
+	}
+	
+	if ((value = strstr_P(line, PSTR("nr="))) || (value = strstr_P(line, PSTR("NR="))))
+	{
+		link_snr = atoi(value + 3);
+	}
+}
+
+// Checks if the LA66 answers at the current baud rate.
+static bool ping()
+{
+	return command_P(PSTR("AT\r\n"), LA66_PING_TIMEOUT / 10) == LA66_SUCCESS;
+}
+
 // PUBLIC
+// Sends a command to the LA66 which is only answered with OK or an error.
+LA66_ReturnCode LA66_command_P(const char *command)
+{
+	return command_P(command, LA66_COMMAND_TIMEOUT * 100);
+}
+
 // Sends a query command to the LA66 and sets the response.
 LA66_ReturnCode LA66_query_command_P(const char *command, char *response)
 {
 	LA66_ReturnCode ret = LA66_ERR_PANIC;
-	char rCommand[strlen_P(command)];
+	char rCommand[strlen_P(command) + 1];
 	char response2[LA66_MAX_BUFF];
 	
 	strcpy_P(rCommand, command);
@@ -180,7 +298,7 @@ LA66_ReturnCode LA66_query_command_P(const char *command, char *response)
 				break;
 			}
 			
-			_delay_ms(10);
+			idle_until(USART_0_is_rx_ready, 10);
 		}
 		
 		if (strcmp_P(response, PSTR(AT_ERROR)) == 0)
@@ -220,7 +338,7 @@ LA66_ReturnCode LA66_query_command_P(const char *command, char *response)
 				break;
 			}
 			
-			_delay_ms(10);
+			idle_until(USART_0_is_rx_ready, 10);
 		}
 	}
 	
@@ -240,21 +358,143 @@ void LA66_activate()
 {
 	LA_RESET_set_level(true);
 	
-	_delay_ms(1000);
+	sleeping = false;
+	params_valid = 0;
+	
+	// the LA66 starts sending join requests
+	tx_begin();
+	
+	idle_until(NULL, 1000);
 }
 
 // Deactivates the LA66 by disabling the RESET pin
 void LA66_deactivate()
 {
 	LA_RESET_set_level(false);
+	transmitting = false;
+	
+	idle_until(NULL, 100);
+}
+
+// Puts the LA66 into sleep mode, the session is retained.
+LA66_ReturnCode LA66_sleep()
+{
+	if (sleeping)
+	{
+		return LA66_SUCCESS;
+	}
+	
+	if (LA66_command_P(PSTR("AT+SLEEP=1\r\n")) != LA66_SUCCESS)
+	{
+		return LA66_ERROR;
+	}
 	
-	_delay_ms(100);
+	sleeping = true;
+	
+	return LA66_SUCCESS;
+}
+
+// Wakes the LA66 from sleep mode by UART activity.
+LA66_ReturnCode LA66_wakeup()
+{
+	if (!sleeping)
+	{
+		return LA66_SUCCESS;
+	}
+	
+	for (uint8_t i = 0; i < LA66_WAKEUP_RETRIES; i++)
+	{
+		// first characters only wake the module and get lost
+		write("\r\n");
+		idle_until(NULL, 50);
+		
+		if (ping())
+		{
+			sleeping = false;
+			
+			return LA66_SUCCESS;
+		}
+	}
+	
+	return LA66_ERROR;
+}
+
+bool LA66_is_sleeping()
+{
+	return sleeping;
 }
 
+// Re-synchronizes the UART link after garbled or missing responses.
+LA66_ReturnCode LA66_resync()
+{
+	clear_read();
+	
+	// terminate whatever the LA66 received so far
+	write("\r\n");
+	idle_until(NULL, 100);
+	
+	clear_read();
+	
+	return ping() ? LA66_SUCCESS : LA66_ERROR;
+}
+
+// Switches the LA66 and USART_0 to baud, falls back to LA66_DEFAULT_BAUD.
+uint32_t LA66_negotiate_baud(uint32_t baud)
+{
+	char command[24];
+	
+	// the LA66 keeps its baud rate across resets, it might already run at the requested rate
+	USART_0_set_baud(baud);
+	
+	if (ping())
+	{
+		return baud;
+	}
+	
+	USART_0_set_baud(LA66_DEFAULT_BAUD);
+	
+	if (baud == LA66_DEFAULT_BAUD || !ping())
+	{
+		return LA66_DEFAULT_BAUD;
+	}
+	
+	snprintf_P(command, sizeof(command), PSTR(LA66_BAUD_COMMAND), baud);
+	
+	if (send_command(command) == LA66_SUCCESS)
+	{
+		// the LA66 answers at the old rate before switching
+		idle_until(NULL, 100);
+		clear_read();
+		
+		USART_0_set_baud(baud);
+		
+		if (ping())
+		{
+			return baud;
+		}
+		
+		USART_0_set_baud(LA66_DEFAULT_BAUD);
+		
+		if (!ping())
+		{
+			// the LA66 switched but does not work reliably at the new rate, try to switch it back
+			USART_0_set_baud(baud);
+			
+			snprintf_P(command, sizeof(command), PSTR(LA66_BAUD_COMMAND), (uint32_t)LA66_DEFAULT_BAUD);
+			send_command(command);
+			idle_until(NULL, 100);
+			
+			USART_0_set_baud(LA66_DEFAULT_BAUD);
+			clear_read();
+		}
+	}
+	
+	return LA66_DEFAULT_BAUD;
+}
 
 // The LA66 automatically tries to join a network when activated.
 // Wait for joined a network.
-LA66_ReturnCode LA66_waitForJoin(void (*led_toggle_func)(void))
+LA66_ReturnCode LA66_waitForJoin(void (*led_toggle_func)(void), uint16_t timeout)
 {
 	LA66_ReturnCode ret = LA66_ERR_PANIC;
 	char response[LA66_MAX_BUFF];
@@ -262,7 +502,12 @@ LA66_ReturnCode LA66_waitForJoin(void (*led_toggle_func)(void))
 	uint16_t blink_counter = 0;
 	bool blink = false;
 	
-	for (uint32_t i = 0; i < LA66_JOIN_TIMEOUT * 100L; i++)
+	if (timeout > LA66_JOIN_TIMEOUT)
+	{
+		timeout = LA66_JOIN_TIMEOUT;
+	}
+	
+	for (uint32_t i = 0; i < timeout * 100L; i++)
 	{
 		if (read_line(response) > 0)
 		{
@@ -272,17 +517,11 @@ LA66_ReturnCode LA66_waitForJoin(void (*led_toggle_func)(void))
 			{
 				log_serial_P(PSTR("Joined network!\r\n"));
 				joined = true;
+				ret = LA66_SUCCESS;
 				
 				break;
 			}
 		}
-		
-		if (joined)
-		{
-			ret = LA66_SUCCESS;
-			
-			break;
-		}
 
 		if (blink)
 		{
@@ -295,7 +534,7 @@ LA66_ReturnCode LA66_waitForJoin(void (*led_toggle_func)(void))
 			}
 		}
 
-		_delay_ms(10);
+		idle_tasks_until(USART_0_is_rx_ready, 10);
 	}
 	
 	if (!joined)
@@ -304,60 +543,192 @@ LA66_ReturnCode LA66_waitForJoin(void (*led_toggle_func)(void))
 		log_serial_P(PSTR("Unable to join network, timeout reached!\r\n"));
 	}
 	
+	transmitting = false;
+	
 	return ret;
 }
 
-// Get the current DR.
+// Counts a lookup in the parameter store, returns true if param is cached.
+static bool cached(uint8_t param)
+{
+	if (params_valid & param)
+	{
+		if (params_hits < 0xFFFF) params_hits++;
+		
+		return true;
+	}
+	
+	if (params_misses < 0xFFFF) params_misses++;
+	
+	return false;
+}
+
+// Get the current DR, cached until ADR might have changed it.
 uint8_t LA66_getDr()
 {
 	LA66_buffer response;
 	
+	if (cached(LA66_PARAM_DR))
+	{
+		return params.dr;
+	}
+	
 	if (LA66_query_command_P(PSTR("AT+DR=?\r\n"), response) == LA66_SUCCESS)
 	{
-		return response[0] - '0';
+		params.dr = response[0] - '0';
+		params_valid |= LA66_PARAM_DR;
+		dr_uplinks = 0;
+		
+		return params.dr;
 	}
 	
 	return 0;
 }
 
-// Get RX1 delay.
+// Reads all parameters into the store.
+void LA66_refreshParams()
+{
+	params_valid = 0;
+	
+	LA66_getDr();
+	LA66_getRx1Dl();
+	LA66_getRx2Dl();
+}
+
+// Gets and resets the hit and miss counters of the parameter store.
+void LA66_getParamStats(uint16_t *hits, uint16_t *misses)
+{
+	*hits = params_hits;
+	*misses = params_misses;
+	
+	params_hits = 0;
+	params_misses = 0;
+}
+
+// Get maximum application payload size at a DR, EU868 regional parameters.
+uint8_t LA66_getMaxPayload(uint8_t dr)
+{
+	static const uint8_t max_payload[] PROGMEM = { 51, 51, 51, 115, 222, 222, 222, 222 };
+	
+	if (dr >= sizeof(max_payload))
+	{
+		return pgm_read_byte(&max_payload[0]);
+	}
+	
+	return pgm_read_byte(&max_payload[dr]);
+}
+
+// Get time on air in ms of an uplink at a DR, EU868 regional parameters,
+// see Semtech AN1200.13 for the formula.
+uint16_t LA66_getAirtime(uint8_t dr, uint8_t size)
+{
+	uint16_t length = size + LA66_FRAME_OVERHEAD;
+	
+	// DR7 is FSK with 50 kbps, 5 bytes preamble, 3 bytes sync word, 1 byte length and 2 bytes CRC
+	if (dr == 7)
+	{
+		return ((length + 11) * 8 + 49) / 50;
+	}
+	
+	// DR0 - DR5 are SF12 - SF7 at 125 kHz, DR6 is SF7 at 250 kHz
+	uint8_t sf = 12 - (dr > 5 ? 5 : dr);
+	uint32_t symbol_us = (dr == 6 ? 4UL : 8UL) << sf;
+	
+	// low data rate optimization for SF11 and SF12 at 125 kHz
+	uint8_t bits_per_symbol = 4 * (sf >= 11 && dr < 6 ? sf - 2 : sf);
+	int16_t payload_bits = 8 * length - 4 * sf + 28 + 16;
+	uint16_t symbols = 8;
+	
+	if (payload_bits > 0)
+	{
+		symbols += (payload_bits + bits_per_symbol - 1) / bits_per_symbol * 5;
+	}
+	
+	// preamble of 8 + 4.25 symbols
+	return ((49 + 4UL * symbols) * symbol_us / 4 + 999) / 1000;
+}
+
+uint8_t LA66_getTxCount()
+{
+	return tx_count;
+}
+
+bool LA66_isTransmitting()
+{
+	return transmitting;
+}
+
+uint8_t LA66_getTxSerial()
+{
+	return tx_serial;
+}
+
+// Get RX1 delay, cached until a reset.
 uint16_t LA66_getRx1Dl()
 {
 	LA66_buffer response;
 	
+	if (cached(LA66_PARAM_RX1DL))
+	{
+		return params.rx1_dl;
+	}
+	
 	if (LA66_query_command_P(PSTR("AT+RX1DL=?\r\n"), response) == LA66_SUCCESS)
 	{
-		return atoi(response);
+		params.rx1_dl = atoi(response);
+		params_valid |= LA66_PARAM_RX1DL;
+		
+		return params.rx1_dl;
 	}
 	
-	return 0;
+	return LA66_DEFAULT_RX1DL;
 }
 
-// Get RX2 delay.
+// Get RX2 delay, cached until a reset.
 uint16_t LA66_getRx2Dl()
 {
 	LA66_buffer response;
 	
+	if (cached(LA66_PARAM_RX2DL))
+	{
+		return params.rx2_dl;
+	}
+	
 	if (LA66_query_command_P(PSTR("AT+RX2DL=?\r\n"), response) == LA66_SUCCESS)
 	{
-		return atoi(response);
+		params.rx2_dl = atoi(response);
+		params_valid |= LA66_PARAM_RX2DL;
+		
+		return params.rx2_dl;
 	}
 	
-	return 0;
+	return LA66_DEFAULT_RX2DL;
 }
 
-// Get timestamp.
+// Get timestamp, once read it is advanced by the uptime.
 uint32_t LA66_getTimestamp()
 {
 	LA66_buffer response;
 	
+	if (cached(LA66_PARAM_TIMESTAMP))
+	{
+		return params.timestamp + (get_uptime() - params.timestamp_uptime);
+	}
+	
 	if (LA66_query_command_P(PSTR("AT+TIMESTAMP=?\r\n"), response) == LA66_SUCCESS)
 	{
-		char timestamp[10];
+		char *timestamp = strchr(response, '(');
+		
+		if (timestamp == NULL)
+		{
+			return 0;
+		}
 		
-		strcpy(timestamp, strchr(response, '(') + 1);
+		params.timestamp = strtoul(timestamp + 1, NULL, 10);
+		params.timestamp_uptime = get_uptime();
+		params_valid |= LA66_PARAM_TIMESTAMP;
 		
-		return atol(timestamp);
+		return params.timestamp;
 	}
 	
 	return 0;
@@ -370,9 +741,16 @@ LA66_ReturnCode LA66_transmitB(uint8_t *fPort, const bool confirm, char *payload
 	LA66_ReturnCode ret = LA66_ERR_PANIC;
 	char buffer[32 + LA66_MAX_BUFF];
 	
+	// the receive windows open these delays after txDone, no commands are possible during the transaction
+	uint16_t rx1_dl = LA66_getRx1Dl();
+	uint16_t rx2_dl = LA66_getRx2Dl();
+	
 	// Command format: AT+SENDB=<confirm>,<fPort>,<data_len>,<data>, example AT+SENDB=0,2,8,05820802581ea0a5
 	snprintf_P(buffer, sizeof(buffer), PSTR("AT+SENDB=0%d,%u,%u,%s\r\n"), confirm, *fPort, strlen(payload) / 2, payload);
 	
+	tx_count = 0;
+	tx_begin();
+	
 	// send command
 	ret = send_command(buffer);
 	
@@ -382,6 +760,7 @@ LA66_ReturnCode LA66_transmitB(uint8_t *fPort, const bool confirm, char *payload
 		// receive
 		LA66_Stage stage = WAIT_FOR_OK;
 		uint32_t timeout;
+		uint8_t rx_timeouts = 0;
 
 		if (confirm)
 		{
@@ -405,6 +784,9 @@ LA66_ReturnCode LA66_transmitB(uint8_t *fPort, const bool confirm, char *payload
 					}
 					else if (strcmp_P(buffer, PSTR(AT_PARAM_ERROR)) == 0)
 					{
+						// might be a payload too long for a changed DR
+						params_valid &= ~LA66_PARAM_DR;
+						
 						ret = LA66_ERR_PARAM;
 						break;
 					}
@@ -431,26 +813,63 @@ LA66_ReturnCode LA66_transmitB(uint8_t *fPort, const bool confirm, char *payload
 					if (strcmp_P(buffer, PSTR("txDone")) == 0)
 					{
 						stage = WAIT_FOR_RX;
+						tx_count++;
+						transmitting = false;
+						
+						// the LA66 lowers the DR itself if no downlink is received for a while (ADR backoff)
+						if (++dr_uplinks >= LA66_DR_REFRESH_UPLINKS)
+						{
+							params_valid &= ~LA66_PARAM_DR;
+						}
 						
-						_delay_100ms(10);
+						idle_tasks_until(NULL, rx1_dl);
 					}
 				}
 				else if (stage == WAIT_FOR_RX || stage == WAIT_FOR_RX2)
 				{
-					if (strcmp_P(buffer, PSTR("rxDone")) == 0)
+					// the LA66 repeats a confirmed uplink until it is acknowledged
+					if (strcmp_P(buffer, PSTR("txDone")) == 0)
+					{
+						stage = WAIT_FOR_RX;
+						tx_count++;
+						transmitting = false;
+						rx_timeouts = 0;
+					}
+					else if (strcmp_P(buffer, PSTR("rxDone")) == 0)
 					{
+						// a downlink might contain ADR commands
+						params_valid &= ~LA66_PARAM_DR;
+						link_new = false;
+						
 						ret = LA66_SUCCESS;
 						
-						_delay_ms(100);
+						// reception quality is printed right after the downlink
+						for (uint8_t j = 0; j < 10; j++)
+						{
+							while (read_line(buffer) > 0)
+							{
+								parse_link(buffer);
+							}
+							
+							idle_tasks_until(NULL, 10);
+						}
 						break;
 					}
+					else if (confirm && strcmp_P(buffer, PSTR("rxTimeout")) == 0)
+					{
+						// no acknowledgement in both receive windows, the repetition follows
+						if (++rx_timeouts == 2)
+						{
+							tx_begin();
+						}
+					}
 					else if (!confirm && strcmp_P(buffer, PSTR("rxTimeout")) == 0)
 					{
 						if (stage == WAIT_FOR_RX)
 						{
 							stage = WAIT_FOR_RX2;
 							
-							_delay_100ms(20);
+							idle_tasks_until(NULL, rx2_dl > rx1_dl ? rx2_dl - rx1_dl : 0);
 						}
 						else
 						{
@@ -461,7 +880,7 @@ LA66_ReturnCode LA66_transmitB(uint8_t *fPort, const bool confirm, char *payload
 				}
 			}
 			
-			_delay_ms(10);
+			idle_tasks_until(USART_0_is_rx_ready, 10);
 		}
 		
 		// check if return code indicates received downlink
@@ -480,21 +899,77 @@ LA66_ReturnCode LA66_transmitB(uint8_t *fPort, const bool confirm, char *payload
 			strcpy(payload, _payload);
 			
 			readHex(payload, _payload);
+			
+			// not printed by all firmware versions, query it instead
+			if (!link_new && LA66_query_command_P(PSTR("AT+RSSI=?\r\n"), buffer) == LA66_SUCCESS)
+			{
+				link_rssi = atoi(buffer);
+				link_new = true;
+				
+				if (LA66_query_command_P(PSTR("AT+SNR=?\r\n"), buffer) == LA66_SUCCESS)
+				{
+					link_snr = atoi(buffer);
+				}
+			}
 		}
 	}
+	
+	transmitting = false;
 
 	return ret;
 }
 
+// Gets RSSI and SNR of the last downlink, only once per downlink.
+bool LA66_getLinkQuality(int16_t *rssi, int8_t *snr)
+{
+	if (!link_new)
+	{
+		return false;
+	}
+	
+	*rssi = link_rssi;
+	*snr = link_snr;
+	link_new = false;
+	
+	return true;
+}
+
+// Gets the SNR in dB a receiver needs at a DR, EU868 regional parameters.
+int8_t LA66_getRequiredSnr(uint8_t dr)
+{
+	static const int8_t required_snr[] PROGMEM = { -20, -17, -15, -12, -10, -7, -7, 0 };
+	
+	if (dr >= sizeof(required_snr))
+	{
+		return 0;
+	}
+	
+	return pgm_read_byte(&required_snr[dr]);
+}
+
+// Sets the TX power, index 0 is the maximum EIRP, each step reduces it by 2 dB.
+LA66_ReturnCode LA66_setTxPower(uint8_t index)
+{
+	char buffer[12];
+	
+	snprintf_P(buffer, sizeof(buffer), PSTR("AT+TXP=%u\r\n"), index);
+	
+	return command(buffer, LA66_COMMAND_TIMEOUT * 100);
+}
+
 LA66_ReturnCode LA66_synctime()
 {
 	log_serial_P(PSTR("In sync\r\n"));
 	
 	LA66_ReturnCode ret = LA66_ERR_PANIC;
 	char buffer[32 + LA66_MAX_BUFF];
+	uint16_t rx1_dl = LA66_getRx1Dl();
 	
 	snprintf_P(buffer, sizeof(buffer), PSTR("AT+DEVICETIMEREQ=1\r\n"));
 	
+	tx_count = 0;
+	tx_begin();
+	
 	// send command
 	ret = send_command(buffer);
 	
@@ -546,25 +1021,31 @@ LA66_ReturnCode LA66_synctime()
 					if (strcmp_P(buffer, PSTR("txDone")) == 0)
 					{
 						stage = WAIT_FOR_SYNCTIMEOK;
+						tx_count++;
+						transmitting = false;
 						
-						_delay_100ms(10);
+						idle_tasks_until(NULL, rx1_dl);
 					}
 				}
 				else if (stage == WAIT_FOR_SYNCTIMEOK)
 				{
 					if (strcmp_P(buffer, PSTR("Sync time ok")) == 0)
 					{
+						params_valid &= ~LA66_PARAM_TIMESTAMP;
+						
 						ret = LA66_SUCCESS;
 						
-						_delay_ms(100);
+						idle_tasks_until(NULL, 100);
 						break;
 					}
 				}
 			}
 			
-			_delay_ms(10);
+			idle_tasks_until(USART_0_is_rx_ready, 10);
 		}
 	}
+	
+	transmitting = false;
 
 	return ret;
 }
\ No newline at end of file
@@ -0,0 +1,67 @@
+/*!
+@file	power.c
+@brief	Power states of the peripherals, the GPIOs and the sleep modes.
+
+@see power.h
+*/
+
+#include "power.h"
+#include <avr/sleep.h>
+
+void power_adc(const bool on)
+{
+	if (on)
+	{
+		PRR0 &= ~(1 << PRADC); // Enable ADC
+		ADC_POWER_set_level(true);
+	}
+	else
+	{
+		ADCSRA &= ~(1 << ADEN);
+		ADC_POWER_set_level(false);
+		PRR0 |= (1 << PRADC); // Disable ADC
+	}
+}
+
+void power_radio(const bool on)
+{
+	LA_RX_set_pull_mode(on ? PORT_PULL_OFF : PORT_PULL_UP);
+}
+
+void power_sleep()
+{
+	// the BOD is disabled by the fuses by default, if enabled it stays off while sleeping,
+	// sleep_cpu() must follow within 4 cycles
+	cli();
+	sleep_enable();
+	#ifdef sleep_bod_disable
+	sleep_bod_disable();
+	#endif
+	sei();
+	sleep_cpu();
+	sleep_disable();
+}
+
+void power_off()
+{
+	cli();
+	
+	// stop the UARTs, the LA66 lines are driven low so an unpowered LA66 is not fed through its pins
+	UCSR0B = 0;
+	UCSR1B = 0;
+	LA_TX_set_level(false);
+	LA_RX_set_pull_mode(PORT_PULL_OFF);
+	
+	ADCSRA = 0;
+	ADC_POWER_set_level(false);
+	
+	PRR0 = (1 << PRTIM2) | (1 << PRTIM0) | (1 << PRTIM1) | (1 << PRTWI0) | (1 << PRUSART1) | (1 << PRUSART0)
+	       | (1 << PRADC) | (1 << PRSPI0);
+	
+	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+	
+	while (1)
+	{
+		power_sleep();
+	}
+}
@@ -48,6 +48,7 @@ static uint8_t          USART_0_txbuf[USART_0_TX_BUFFER_SIZE];
 static volatile uint8_t USART_0_tx_head;
 static volatile uint8_t USART_0_tx_tail;
 static volatile uint8_t USART_0_tx_elements;
+static volatile uint8_t USART_0_tx_started;
 
 void USART_0_default_rx_isr_cb(void);
 void (*USART_0_rx_isr_cb)(void) = &USART_0_default_rx_isr_cb;
@@ -86,6 +87,9 @@ void USART_0_default_udre_isr_cb(void)
 		tmptail = (USART_0_tx_tail + 1) & USART_0_TX_BUFFER_MASK;
 		/* Store new index */
 		USART_0_tx_tail = tmptail;
+		/* Clear TXC so it flags the end of this frame */
+		UCSR0A = (UCSR0A & (1 << U2X0)) | (1 << TXC0);
+		USART_0_tx_started = 1;
 		/* Start transmission */
 		UDR0 = USART_0_txbuf[tmptail];
 		USART_0_tx_elements--;
@@ -262,6 +266,29 @@ int8_t USART_0_init()
 	return 0;
 }
 
+/**
+ * \brief Set the baud rate of USART_0 at runtime
+ * Waits until the TX ringbuffer is empty and the last frame has left the
+ * shift register, a baud rate change would garble it otherwise. Always uses
+ * double speed mode which gives the lowest error at F_CPU 8MHz.
+ *
+ * \param[in] baud The baud rate to set
+ *
+ * \return Nothing
+ */
+void USART_0_set_baud(const uint32_t baud)
+{
+	while (USART_0_tx_elements != 0)
+		;
+
+	/* TXC is only set once a frame was sent since power up */
+	while (USART_0_tx_started && USART_0_is_tx_busy())
+		;
+
+	UBRR0 = (F_CPU + 4 * baud) / (8 * baud) - 1;
+	UCSR0A |= 1 << U2X0;
+}
+
 /**
  * \brief Enable RX and TX in USART_0
  * 1. If supported by the clock system, enables the clock to the USART
@@ -0,0 +1,110 @@
+// Decodes the uplinks printed by lofence_sim -u with scripts/decoder.js and checks them
+// against the simulated voltages, payloads the simulated LA66 rejected fail as well.
+// Usage: ./lofence_sim -u -f 8000 -b 3600 msr_interval=60 | node check_uplinks.js 8000 3600
+
+var decoder = require("../../scripts/decoder.js");
+
+var fence = parseInt(process.argv[2] || "8000", 10);
+var battery = parseInt(process.argv[3] || "3600", 10);
+
+// one ADC step of the fence at the default max_volt plus noise, one of the battery
+var FENCE_TOLERANCE = 150;
+var BATTERY_TOLERANCE = 50;
+
+var uplinks = 0;
+var failures = 0;
+
+function fail(line, message) {
+  console.log("FAIL " + message + ": " + line);
+  failures++;
+}
+
+function near(value, expected, tolerance) {
+  return Math.abs(value - expected) <= tolerance;
+}
+
+function checkLine(line) {
+  var match = /^uplink (\d+) ([0-9A-Fa-f]*)$/.exec(line);
+
+  if (!match) {
+    if (line.indexOf("invalid uplink ") === 0) {
+      fail(line, "payload rejected by the LA66");
+    } else if (line.indexOf("uplink ") === 0) {
+      fail(line, "malformed uplink");
+    }
+
+    return;
+  }
+
+  var port = parseInt(match[1], 10);
+  var hex = match[2];
+  var bytes = [];
+
+  uplinks++;
+
+  if (hex.length === 0 || hex.length % 2 !== 0) {
+    fail(line, "odd or empty payload");
+    return;
+  }
+
+  for (var i = 0; i < hex.length; i += 2) {
+    bytes.push(parseInt(hex.substr(i, 2), 16));
+  }
+
+  var result = decoder.decodeUplink({ fPort: port, bytes: bytes });
+
+  if (result.errors) {
+    fail(line, result.errors.join(", "));
+    return;
+  }
+
+  var data = result.data;
+
+  switch (port) {
+    case 1:
+      if (!near(data.volt_bat, battery, BATTERY_TOLERANCE) || !near(data.volt_fence_plus, fence, FENCE_TOLERANCE) ||
+        !near(data.volt_fence_minus, fence, FENCE_TOLERANCE)) {
+        fail(line, "data " + JSON.stringify(data));
+      }
+      break;
+
+    case 6:
+      // header of 60 bits and two deltas per further sample, padded to full bytes
+      var width = bytes[0] & 0x0F;
+      var length = Math.ceil((60 + (data.samples.length - 1) * 2 * width) / 8);
+
+      if (bytes.length !== length) {
+        fail(line, "batch of " + data.samples.length + " samples has " + bytes.length + " bytes instead of " + length);
+      }
+
+      if (!near(data.volt_bat, battery, BATTERY_TOLERANCE)) {
+        fail(line, "batch battery " + data.volt_bat);
+      }
+
+      for (i = 0; i < data.samples.length; i++) {
+        if (!near(data.samples[i].volt_fence_plus, fence, FENCE_TOLERANCE) || !near(data.samples[i].volt_fence_minus, fence, FENCE_TOLERANCE)) {
+          fail(line, "batch sample " + JSON.stringify(data.samples[i]));
+        }
+      }
+      break;
+
+    case 7:
+      if (!data.config_crc_valid) {
+        fail(line, "config CRC");
+      }
+      break;
+  }
+}
+
+var input = "";
+
+process.stdin.on("data", function (chunk) {
+  input += chunk;
+});
+
+process.stdin.on("end", function () {
+  input.split("\n").forEach(checkLine);
+
+  console.log(uplinks + " uplinks decoded, " + failures + " failed");
+  process.exit(failures > 0 || uplinks === 0 ? 1 : 0);
+});
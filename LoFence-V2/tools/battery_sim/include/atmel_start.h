@@ -0,0 +1,50 @@
+// Replaces the Atmel START drivers for the host simulation, see sim.c.
+
+#ifndef SIM_ATMEL_START_H_
+#define SIM_ATMEL_START_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/eeprom.h>
+#include <avr/sleep.h>
+#include <avr/boot.h>
+
+enum port_pull_mode
+{
+	PORT_PULL_OFF,
+	PORT_PULL_UP,
+};
+
+void atmel_start_init(void);
+
+bool USART_0_is_tx_ready();
+bool USART_0_is_tx_busy();
+bool USART_0_is_rx_ready();
+uint8_t USART_0_read();
+void USART_0_write(const uint8_t data);
+void USART_0_set_baud(const uint32_t baud);
+
+bool USART_1_is_tx_ready();
+bool USART_1_is_tx_busy();
+void USART_1_write(const uint8_t data);
+
+void LA_RESET_set_level(const bool level);
+void LA_TX_set_level(const bool level);
+void LA_RX_set_pull_mode(const enum port_pull_mode pull_mode);
+void ADC_POWER_set_level(const bool level);
+void BAT_GND_set_level(const bool level);
+void ACTIVATE_set_level(const bool level);
+
+// LEDs are not simulated
+#define LED_IDLE_set_level(level)
+#define LED_MSR_set_level(level)
+#define LED_TX_set_level(level)
+#define LED_CLK_toggle_level()
+void LED_TX_toggle_level(void);
+
+#endif /* SIM_ATMEL_START_H_ */
@@ -0,0 +1,9 @@
+#ifndef SIM_AVR_BOOT_H_
+#define SIM_AVR_BOOT_H_
+
+#include <stdint.h>
+
+// signature row incl. the serial number, derived from the simulation seed
+uint8_t boot_signature_byte_get(uint8_t address);
+
+#endif /* SIM_AVR_BOOT_H_ */
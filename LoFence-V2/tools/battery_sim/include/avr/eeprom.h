@@ -0,0 +1,21 @@
+#ifndef SIM_AVR_EEPROM_H_
+#define SIM_AVR_EEPROM_H_
+
+#include <stdint.h>
+
+// EEPROM variables are plain variables, sim.c sets them from the command line
+#define EEMEM
+
+static inline uint8_t eeprom_read_byte(const uint8_t *p) { return *p; }
+static inline uint16_t eeprom_read_word(const uint16_t *p) { return *p; }
+static inline uint32_t eeprom_read_dword(const uint32_t *p) { return *p; }
+
+static inline void eeprom_write_byte(uint8_t *p, uint8_t value) { *p = value; }
+static inline void eeprom_write_word(uint16_t *p, uint16_t value) { *p = value; }
+static inline void eeprom_write_dword(uint32_t *p, uint32_t value) { *p = value; }
+
+#define eeprom_update_byte eeprom_write_byte
+#define eeprom_update_word eeprom_write_word
+#define eeprom_update_dword eeprom_write_dword
+
+#endif /* SIM_AVR_EEPROM_H_ */
@@ -0,0 +1,14 @@
+#ifndef SIM_AVR_INTERRUPT_H_
+#define SIM_AVR_INTERRUPT_H_
+
+// ISRs are plain functions called by the simulated peripherals
+#define ISR(vector) void vector(void)
+
+void TIMER2_OVF_vect(void);
+void TIMER2_COMPA_vect(void);
+void ADC_vect(void);
+
+#define cli()
+#define sei()
+
+#endif /* SIM_AVR_INTERRUPT_H_ */
@@ -0,0 +1,82 @@
+// Registers of the ATmega328PB used by the firmware, simulated by sim.c.
+
+#ifndef SIM_AVR_IO_H_
+#define SIM_AVR_IO_H_
+
+#include <stdint.h>
+
+extern volatile uint8_t TCCR2B, ASSR, TIFR2, TIMSK2, OCR2A, GTCCR;
+extern volatile uint8_t PRR0, PRR1, ADMUX, ADCSRA, ADCSRB, ADCH, DIDR0, ACSR;
+extern volatile uint8_t SMCR, MCUCR, UCSR0B, UCSR1B;
+
+// reading the counter takes CPU time, busy loops on it advance the simulated clock
+uint8_t sim_tcnt2();
+#define TCNT2 (sim_tcnt2())
+
+#define CS20 0
+#define CS21 1
+#define CS22 2
+
+#define TOIE2 0
+#define OCIE2A 1
+#define OCIE2B 2
+
+#define TOV2 0
+#define OCF2A 1
+#define OCF2B 2
+
+#define TCR2BUB 0
+#define TCR2AUB 1
+#define OCR2BUB 2
+#define OCR2AUB 3
+#define TCN2UB 4
+#define AS2 5
+
+#define PSRASY 1
+
+#define PRADC 0
+#define PRUSART0 1
+#define PRSPI0 2
+#define PRTIM1 3
+#define PRUSART1 4
+#define PRTIM0 5
+#define PRTIM2 6
+#define PRTWI0 7
+
+#define MUX0 0
+#define MUX1 1
+#define MUX2 2
+#define MUX3 3
+#define ADLAR 5
+#define REFS0 6
+#define REFS1 7
+
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define ADIE 3
+#define ADIF 4
+#define ADATE 5
+#define ADSC 6
+#define ADEN 7
+
+#define ADTS0 0
+#define ADTS1 1
+#define ADTS2 2
+#define ACME 6
+
+#define ADC0D 0
+#define ADC1D 1
+#define ADC2D 2
+#define ADC3D 3
+#define ADC4D 4
+#define ADC5D 5
+
+#define ACD 7
+
+#define SE 0
+#define SM0 1
+#define SM1 2
+#define SM2 3
+
+#endif /* SIM_AVR_IO_H_ */
@@ -0,0 +1,18 @@
+#ifndef SIM_UTIL_CRC16_H_
+#define SIM_UTIL_CRC16_H_
+
+#include <stdint.h>
+
+static inline uint16_t _crc_xmodem_update(uint16_t crc, uint8_t data)
+{
+	crc ^= (uint16_t)data << 8;
+	
+	for (uint8_t i = 0; i < 8; i++)
+	{
+		crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	
+	return crc;
+}
+
+#endif /* SIM_UTIL_CRC16_H_ */
@@ -0,0 +1,8 @@
+#ifndef SIM_UTIL_DELAY_H_
+#define SIM_UTIL_DELAY_H_
+
+// busy waits, the CPU is active for the simulated time
+void _delay_ms(double ms);
+void _delay_us(double us);
+
+#endif /* SIM_UTIL_DELAY_H_ */
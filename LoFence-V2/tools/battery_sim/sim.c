@@ -0,0 +1,1200 @@
+// Battery life simulation of the LoFence-V2 firmware on the host.
+//
+// main.c, la66.c, codec.c and power.c are compiled unchanged against the headers in include/
+// which simulate the used parts of the ATmega328PB: TIMER2 on the 32 kHz crystal, the sleep modes,
+// the ADC and the UARTs. The LA66 is simulated on the AT command level, so the real driver
+// runs with its timeouts and the receive windows. The simulated clock only advances while
+// the firmware waits, sleeps, reads the timer or writes to a UART.
+//
+// Usage: lofence_sim [-d days] [-r dr] [-b battery mV] [-f fence V] [-c capacity mAh] [-s seed] [-p hh:mm,tdc,msr_ms,confirm] [-t] [-u] [-v] [setting=value...]
+// The settings are the EEPROM settings of main.c, e.g. tdc=600 msr_ms=3000 daily_confirmed_uplinks=2.
+// -p adds a time-of-day profile (up to PROFILE_COUNT), e.g. -p 20:00,1800,3000,1 -p 06:00,300,0,0.
+// -t runs the self-tests of the LA66 driver against the simulated module instead (make test).
+// -u prints every uplink as "uplink <fPort> <hex payload>", check_uplinks.js decodes them with scripts/decoder.js.
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atmel_start.h>
+#include <util/delay.h>
+#include "la66.h"
+
+// main.h declares the firmware main() which is renamed for the simulation
+#define main firmware_main
+#include "main.h"
+#undef main
+
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+
+// estimated currents in uA of the parts of the device, calibrate with a measurement of the actual hardware
+#define MCU_ACTIVE_UA 3000 // 8 MHz at 3.3 V
+#define MCU_IDLE_UA 1000
+#define MCU_POWER_SAVE_UA 2 // incl. the 32 kHz crystal
+#define ADC_UA 300 // ADC enabled
+#define CIRCUIT_UA 1500 // measurement circuit powered (ADC_POWER)
+#define LA66_RESET_UA 1000 // held in reset
+#define LA66_SLEEP_UA 5 // sleep mode with the session retained
+#define LA66_IDLE_UA 6000 // awake, not transmitting or receiving
+#define LA66_TX_UA 45000 // time on air
+#define LA66_RX_UA 10000 // receive windows
+#define LA66_RX_WINDOW_MS 100 // time the LA66 listens per receive window
+
+// time in s the LA66 needs to join after it is activated
+#define LA66_JOIN_SECONDS 8
+
+// drop of the battery voltage in mV while the LA66 transmits
+#define LA66_TX_SAG_MV 300
+
+// default RX1 and RX2 delays in ms
+#define LA66_RX1_DELAY 1000
+#define LA66_RX2_DELAY 2000
+
+// EEPROM settings of main.c
+extern uint32_t tdc;
+extern uint32_t tdc_min;
+extern uint32_t tdc_max;
+extern uint16_t msr_ms;
+extern uint16_t max_volt;
+extern uint16_t bat_low;
+extern uint8_t bat_low_count_max;
+extern uint16_t bat_low_min;
+extern uint8_t daily_confirmed_uplinks;
+extern uint16_t rbe_fence_delta;
+extern uint16_t rbe_bat_delta;
+extern uint8_t rbe_heartbeat;
+extern uint16_t alarm_volt;
+extern uint16_t alarm_interval;
+extern uint8_t alarm_confirm;
+extern uint16_t msr_interval;
+extern uint8_t settings_legacy;
+extern uint16_t airtime_day;
+extern uint8_t link_adapt;
+
+extern profile profiles[PROFILE_COUNT];
+extern uint8_t settings_layout;
+extern volatile uint8_t tick_period;
+extern volatile uint32_t sleep_seconds;
+
+void check_settings();
+uint32_t get_tdc();
+void firmware_pause();
+bool handle_command(uint8_t type, const char *data, uint8_t size, bool apply);
+extern uint32_t cycle_start_day_seconds;
+extern volatile uint32_t day_seconds;
+void set_tick_until(uint32_t until);
+void idle_ms(uint16_t ms);
+bool idle_until(bool (*ready)(), uint16_t ms);
+void measure_start(uint8_t parts);
+void measure_finish();
+extern uint8_t msr_stage;
+extern uint16_t volt_bat;
+extern volatile int16_t drift_ppm;
+extern bool time_synced;
+extern uint32_t sync_timestamp;
+extern uint32_t sync_uptime;
+extern uint32_t sync_interval;
+void sync_time();
+
+typedef struct sim_setting
+{
+	const char *name;
+	void *value;
+	uint8_t size;
+} sim_setting;
+
+static const sim_setting settings[] = {
+	{ "tdc", &tdc, 4 },
+	{ "tdc_min", &tdc_min, 4 },
+	{ "tdc_max", &tdc_max, 4 },
+	{ "msr_ms", &msr_ms, 2 },
+	{ "max_volt", &max_volt, 2 },
+	{ "bat_low", &bat_low, 2 },
+	{ "bat_low_count_max", &bat_low_count_max, 1 },
+	{ "bat_low_min", &bat_low_min, 2 },
+	{ "daily_confirmed_uplinks", &daily_confirmed_uplinks, 1 },
+	{ "rbe_fence_delta", &rbe_fence_delta, 2 },
+	{ "rbe_bat_delta", &rbe_bat_delta, 2 },
+	{ "rbe_heartbeat", &rbe_heartbeat, 1 },
+	{ "alarm_volt", &alarm_volt, 2 },
+	{ "alarm_interval", &alarm_interval, 2 },
+	{ "alarm_confirm", &alarm_confirm, 1 },
+	{ "msr_interval", &msr_interval, 2 },
+	{ "settings_legacy", &settings_legacy, 1 },
+	{ "airtime_day", &airtime_day, 2 },
+	{ "link_adapt", &link_adapt, 1 },
+};
+
+volatile uint8_t TCCR2B, ASSR, TIFR2, TIMSK2, OCR2A, GTCCR;
+volatile uint8_t PRR0, PRR1, ADMUX, ADCSRA, ADCSRB, ADCH, DIDR0, ACSR;
+volatile uint8_t SMCR, MCUCR, UCSR0B, UCSR1B;
+
+// simulation parameters
+static double days = 30;
+static uint8_t dr = 5;
+static uint16_t battery_mv = 3600;
+static uint16_t fence_volt = 8000;
+static uint16_t capacity_mah = 2600;
+static uint32_t seed = 1;
+static bool verbose = false;
+static bool test = false;
+static bool print_uplinks = false;
+static uint8_t profile_count = 0;
+
+// simulated time in us
+static uint64_t now_us = 0;
+static uint64_t end_us = 0;
+
+// TIMER2, start and length of the running period
+static uint64_t timer_start = 0;
+static uint64_t timer_period = 1000000;
+
+#define MCU_ACTIVE 0
+#define MCU_IDLE 1
+#define MCU_POWER_SAVE 2
+
+static uint8_t mcu_mode = MCU_ACTIVE;
+static bool circuit = false;
+
+// LA66
+typedef struct sim_line
+{
+	uint64_t time;
+	uint32_t baud;
+	char text[64];
+} sim_line;
+
+#define LA66_LINES 16
+
+static sim_line la_lines[LA66_LINES];
+static uint8_t la_count = 0;
+static uint8_t la_pos = 0;
+static char la_command[LA66_MAX_BUFF];
+static uint8_t la_command_length = 0;
+static uint32_t la_baud = LA66_DEFAULT_BAUD;
+static uint32_t la_module_baud = LA66_DEFAULT_BAUD;
+static bool la_active = false;
+static bool la_sleeping = false;
+static uint8_t la_lost_acks = 0;
+static uint64_t la_join_us = 0;
+static uint64_t la_tx_start[8];
+static uint64_t la_tx_end[8];
+static uint8_t la_tx_next = 0;
+
+// statistics
+static uint64_t mcu_us[3];
+static uint64_t circuit_us = 0;
+static uint64_t la_awake_us = 0;
+static double mcu_uas = 0;
+static double circuit_uas = 0;
+static double la_uas = 0;
+static uint32_t uplinks = 0;
+static uint32_t uplinks_confirmed = 0;
+static uint32_t uplinks_invalid = 0;
+static uint32_t uplinks_port[256];
+static uint32_t joins = 0;
+static uint32_t time_syncs = 0;
+static uint64_t airtime_ms = 0;
+static bool deactivated = false;
+
+static void finish()
+{
+	double seconds = now_us / 1e6;
+	double per_day = 86400 / seconds;
+	double charge = (mcu_uas + circuit_uas + la_uas) / 3600 / 1000;
+	
+	printf("Simulated %.1f days, DR%u, battery %u mV, fence %u V\n", seconds / 86400, dr, battery_mv, fence_volt);
+	printf("Settings:");
+	
+	for (uint8_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++)
+	{
+		uint32_t value = settings[i].size == 4 ? *(uint32_t *)settings[i].value : settings[i].size == 2 ? *(uint16_t *)settings[i].value : *(uint8_t *)settings[i].value;
+		
+		printf(" %s=%u", settings[i].name, value);
+	}
+	
+	for (uint8_t i = 0; i < PROFILE_COUNT; i++)
+	{
+		if (profiles[i].start < 1440)
+		{
+			printf("\nProfile %u: from %02u:%02u tdc=%u msr_ms=%u confirm=%u", i, profiles[i].start / 60, profiles[i].start % 60,
+				profiles[i].tdc, profiles[i].msr_ms, profiles[i].confirm);
+		}
+	}
+	
+	printf("\n\nPer day:\n");
+	printf("  uplinks            %8.1f (%.1f confirmed)\n", uplinks * per_day, uplinks_confirmed * per_day);
+	
+	for (uint16_t port = 0; port < 256; port++)
+	{
+		if (uplinks_port[port] > 0)
+		{
+			printf("    fPort %-3u        %8.1f\n", port, uplinks_port[port] * per_day);
+		}
+	}
+	
+	printf("  joins              %8.1f\n", joins * per_day);
+	printf("  time syncs         %8.1f\n", time_syncs * per_day);
+	
+	if (uplinks_invalid > 0)
+	{
+		printf("  invalid uplinks    %8.1f\n", uplinks_invalid * per_day);
+	}
+	printf("  airtime            %8.1f s\n", airtime_ms / 1000.0 * per_day);
+	printf("  MCU active         %8.1f s\n", mcu_us[MCU_ACTIVE] / 1e6 * per_day);
+	printf("  MCU idle           %8.1f s\n", mcu_us[MCU_IDLE] / 1e6 * per_day);
+	printf("  measurement on     %8.1f s\n", circuit_us / 1e6 * per_day);
+	printf("  LA66 awake         %8.1f s\n", la_awake_us / 1e6 * per_day);
+	printf("  charge             %8.3f mAh (MCU %.3f, measurement %.3f, LA66 %.3f)\n", charge * per_day,
+		mcu_uas / 3.6e6 * per_day, circuit_uas / 3.6e6 * per_day, la_uas / 3.6e6 * per_day);
+	printf("\nAverage current %.1f uA, projected battery life %.0f days with %u mAh\n",
+		charge * 3600 * 1000 / seconds, capacity_mah / (charge * per_day), capacity_mah);
+	
+	if (deactivated)
+	{
+		printf("The device deactivated itself after %.2f days (battery low)\n", seconds / 86400);
+	}
+	
+	exit(0);
+}
+
+// Accounts the charge of us microseconds in the current state.
+static void account(uint64_t us)
+{
+	uint16_t mcu_current[] = { MCU_ACTIVE_UA, MCU_IDLE_UA, MCU_POWER_SAVE_UA };
+	double seconds = us / 1e6;
+	
+	mcu_us[mcu_mode] += us;
+	mcu_uas += seconds * mcu_current[mcu_mode];
+	
+	if ((ADCSRA & (1 << ADEN)) && mcu_mode <= MCU_IDLE)
+	{
+		mcu_uas += seconds * ADC_UA;
+	}
+	
+	if (circuit)
+	{
+		circuit_us += us;
+		circuit_uas += seconds * CIRCUIT_UA;
+	}
+	
+	if (!la_active)
+	{
+		la_uas += seconds * LA66_RESET_UA;
+	}
+	else if (la_sleeping)
+	{
+		la_uas += seconds * LA66_SLEEP_UA;
+	}
+	else
+	{
+		la_awake_us += us;
+		la_uas += seconds * LA66_IDLE_UA;
+	}
+}
+
+// Remembers a transmission of the LA66 from start to end for the battery sag.
+static void la_tx(uint64_t start, uint64_t end)
+{
+	la_tx_start[la_tx_next] = start;
+	la_tx_end[la_tx_next] = end;
+	la_tx_next = (la_tx_next + 1) % 8;
+}
+
+static bool la_transmitting()
+{
+	for (uint8_t i = 0; i < 8; i++)
+	{
+		if (now_us >= la_tx_start[i] && now_us < la_tx_end[i])
+		{
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+// Feeds the ADC ISR with a sample of the selected input.
+static void sample_adc()
+{
+	if (!(ADCSRA & (1 << ADEN)) || (PRR0 & (1 << PRADC)))
+	{
+		return;
+	}
+	
+	int16_t value = 0;
+	uint8_t mux = ADMUX & 0x0F;
+	
+	if (mux == (1 << MUX2))
+	{
+		// inverse of the battery voltage calculation in main.c, the battery sags while the LA66 transmits
+		value = ((int32_t)battery_mv - (la_transmitting() ? LA66_TX_SAG_MV : 0) - 125) * 100 / (330000 / 255 * 2);
+	}
+	else if (circuit)
+	{
+		value = (uint32_t)fence_volt * 255 / max_volt;
+	}
+	
+	value += rand() % 3 - 1;
+	
+	ADCH = MAX(0, MIN(255, value));
+	ADC_vect();
+}
+
+// Advances the simulated time by us microseconds, runs the TIMER2 overflows in between.
+static void advance(uint64_t us)
+{
+	uint64_t target = now_us + us;
+	
+	while (1)
+	{
+		uint64_t overflow = timer_start + timer_period;
+		uint64_t next = MIN(target, overflow);
+		
+		account(next - now_us);
+		now_us = next;
+		
+		if (now_us >= end_us)
+		{
+			finish();
+		}
+		
+		if (now_us < overflow)
+		{
+			break;
+		}
+		
+		timer_start = overflow;
+		TIMER2_OVF_vect();
+		
+		// prescaler 1024 or 128
+		timer_period = (TCCR2B & 0x07) == 0x07 ? 8000000 : 1000000;
+		
+		if (now_us >= target)
+		{
+			break;
+		}
+	}
+	
+	sample_adc();
+}
+
+uint8_t sim_tcnt2()
+{
+	advance(4);
+	
+	return MIN(255, (now_us - timer_start) * 256 / timer_period);
+}
+
+void _delay_ms(double ms)
+{
+	advance(ms * 1000);
+}
+
+void _delay_us(double us)
+{
+	advance(us);
+}
+
+void sim_sleep()
+{
+	if (!(SMCR & (1 << SE)))
+	{
+		return;
+	}
+	
+	uint8_t mode = SMCR & ((1 << SM0) | (1 << SM1) | (1 << SM2));
+	uint64_t wake = timer_start + timer_period;
+	bool compare = false;
+	
+	if (mode == SLEEP_MODE_IDLE)
+	{
+		mcu_mode = MCU_IDLE;
+		
+		if (TIMSK2 & (1 << OCIE2A))
+		{
+			uint64_t match = timer_start + OCR2A * timer_period / 256;
+			
+			if (match <= now_us)
+			{
+				match += timer_period;
+			}
+			
+			if (match < wake)
+			{
+				wake = match;
+				compare = true;
+			}
+		}
+		
+		// USART0 RX interrupt when the next line arrives, arrived lines wait in the buffer
+		for (uint8_t i = 0; i < la_count; i++)
+		{
+			if (la_lines[i].time > now_us)
+			{
+				if (la_lines[i].time < wake)
+				{
+					wake = la_lines[i].time;
+					compare = false;
+				}
+				
+				break;
+			}
+		}
+	}
+	else if (mode == SLEEP_MODE_PWR_SAVE)
+	{
+		mcu_mode = MCU_POWER_SAVE;
+	}
+	else if (mode == SLEEP_MODE_PWR_DOWN)
+	{
+		// nothing wakes the device anymore
+		deactivated = true;
+		finish();
+	}
+	
+	advance(wake - now_us);
+	
+	if (compare)
+	{
+		TIMER2_COMPA_vect();
+	}
+	
+	mcu_mode = MCU_ACTIVE;
+}
+
+uint8_t boot_signature_byte_get(uint8_t address)
+{
+	return (seed * 2654435761UL + address * 40503UL) >> 8;
+}
+
+void atmel_start_init(void)
+{
+	PRR0 = (1 << PRTIM0) | (1 << PRTIM1) | (1 << PRTWI0) | (1 << PRADC) | (1 << PRSPI0);
+	TCCR2B = (1 << CS22) | (1 << CS20);
+	TIMSK2 = (1 << TOIE2);
+	SMCR = SLEEP_MODE_PWR_SAVE;
+}
+
+// ----------------------------------------------------------------------------------------------
+
+// Queues a response line of the LA66 which can be read after delay ms,
+// the lines are sorted by time like unsolicited lines (JOINED) are interleaved with responses.
+static void la_reply(uint32_t delay, const char *text)
+{
+	if (la_count == LA66_LINES)
+	{
+		return;
+	}
+	
+	uint64_t time = now_us + delay * 1000ULL;
+	uint8_t i = la_count;
+	
+	// never before a partially read line
+	while (i > (la_pos > 0 ? 1 : 0) && la_lines[i - 1].time > time)
+	{
+		la_lines[i] = la_lines[i - 1];
+		i--;
+	}
+	
+	la_lines[i].time = time;
+	la_lines[i].baud = la_module_baud;
+	snprintf(la_lines[i].text, sizeof(la_lines[i].text), "%s\r\n", text);
+	la_count++;
+}
+
+// Simulates an uplink of size bytes, the LA66 answers like with the default RX delays.
+static void la_send(bool confirm, uint8_t port, uint8_t size, const char *payload)
+{
+	if (now_us < la_join_us)
+	{
+		la_reply(10, AT_NO_NET_JOINED);
+		return;
+	}
+	
+	uint16_t airtime = LA66_getAirtime(dr, size);
+	uint32_t tx_done = 20 + airtime;
+	uint8_t transmissions = 1;
+	
+	la_reply(10, AT_OK);
+	la_reply(tx_done, "txDone");
+	la_tx(now_us + 20000, now_us + tx_done * 1000ULL);
+	
+	// a lost acknowledgement makes the LA66 repeat a confirmed uplink
+	for (; confirm && la_lost_acks > 0; la_lost_acks--)
+	{
+		la_reply(tx_done + LA66_RX1_DELAY + LA66_RX_WINDOW_MS, "rxTimeout");
+		la_reply(tx_done + LA66_RX2_DELAY + LA66_RX_WINDOW_MS, "rxTimeout");
+		tx_done += LA66_RX2_DELAY + LA66_RX_WINDOW_MS + 1000 + airtime;
+		la_reply(tx_done, "txDone");
+		la_tx(now_us + (tx_done - airtime) * 1000ULL, now_us + tx_done * 1000ULL);
+		transmissions++;
+	}
+	
+	if (port == 0)
+	{
+		la_reply(tx_done + LA66_RX1_DELAY + LA66_RX_WINDOW_MS, "Sync time ok");
+		time_syncs++;
+	}
+	else if (confirm)
+	{
+		la_reply(tx_done + LA66_RX1_DELAY + LA66_RX_WINDOW_MS, "rxDone");
+		la_reply(tx_done + LA66_RX1_DELAY + LA66_RX_WINDOW_MS, "Rssi= -95, Snr= 4");
+		uplinks_confirmed++;
+	}
+	else
+	{
+		la_reply(tx_done + LA66_RX1_DELAY + LA66_RX_WINDOW_MS, "rxTimeout");
+		la_reply(tx_done + LA66_RX2_DELAY + LA66_RX_WINDOW_MS, "rxTimeout");
+	}
+	
+	if (port > 0)
+	{
+		uplinks++;
+		uplinks_port[port]++;
+		
+		if (print_uplinks)
+		{
+			printf("uplink %u %s\n", port, payload);
+		}
+	}
+	
+	airtime_ms += transmissions * airtime;
+	la_uas += transmissions * airtime / 1000.0 * (LA66_TX_UA - LA66_IDLE_UA);
+	la_uas += (confirm || port == 0 ? 1 : 2) * LA66_RX_WINDOW_MS / 1000.0 * (LA66_RX_UA - LA66_IDLE_UA);
+	la_uas += (transmissions - 1) * 2 * LA66_RX_WINDOW_MS / 1000.0 * (LA66_RX_UA - LA66_IDLE_UA);
+}
+
+// Decodes the hex payload of AT+SENDB, false if it is not exactly size bytes.
+static bool la_decode(const char *hex, unsigned size, uint8_t *bytes)
+{
+	if (size == 0 || size > 242 || strlen(hex) != size * 2)
+	{
+		return false;
+	}
+	
+	for (unsigned i = 0; i < size; i++)
+	{
+		if (!isxdigit((unsigned char)hex[i * 2]) || !isxdigit((unsigned char)hex[i * 2 + 1]) ||
+			sscanf(hex + i * 2, "%2hhx", &bytes[i]) != 1)
+		{
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+// Answers a command line of the firmware.
+static void la_execute(char *command)
+{
+	char response[24];
+	unsigned confirm;
+	unsigned port;
+	unsigned size;
+	int payload;
+	uint8_t bytes[242];
+	unsigned long baud;
+	
+	if (la_sleeping)
+	{
+		// the first characters only wake the LA66
+		la_sleeping = false;
+		return;
+	}
+	
+	if (command[0] == '\0')
+	{
+		return;
+	}
+	
+	if (sscanf(command, "AT+SENDB=%u,%u,%u,%n", &confirm, &port, &size, &payload) == 3)
+	{
+		if (la_decode(command + payload, size, bytes))
+		{
+			la_send(confirm, port, size, command + payload);
+		}
+		else
+		{
+			// the LA66 rejects a payload which is no hex of the stated size
+			la_reply(10, AT_PARAM_ERROR);
+			uplinks_invalid++;
+			
+			if (print_uplinks)
+			{
+				printf("invalid uplink %u %u %s\n", port, size, command + payload);
+			}
+		}
+	}
+	else if (strcmp(command, "AT+DEVICETIMEREQ=1") == 0)
+	{
+		la_send(false, 0, 0, "");
+	}
+	else if (strcmp(command, "AT+DR=?") == 0)
+	{
+		snprintf(response, sizeof(response), "%u", dr);
+		la_reply(10, response);
+		la_reply(10, AT_OK);
+	}
+	else if (strcmp(command, "AT+RX1DL=?") == 0)
+	{
+		snprintf(response, sizeof(response), "%u", LA66_RX1_DELAY);
+		la_reply(10, response);
+		la_reply(10, AT_OK);
+	}
+	else if (strcmp(command, "AT+RX2DL=?") == 0)
+	{
+		snprintf(response, sizeof(response), "%u", LA66_RX2_DELAY);
+		la_reply(10, response);
+		la_reply(10, AT_OK);
+	}
+	else if (strcmp(command, "AT+TIMESTAMP=?") == 0)
+	{
+		// 2026-01-01 00:00:00 UTC at the start of the simulation
+		snprintf(response, sizeof(response), "time (%lu)", 1767225600UL + (unsigned long)(now_us / 1000000));
+		la_reply(10, response);
+		la_reply(10, AT_OK);
+	}
+	else if (strcmp(command, "AT+RECVB=?") == 0)
+	{
+		la_reply(10, "0:");
+		la_reply(10, AT_OK);
+	}
+	else if (strcmp(command, "AT+RSSI=?") == 0)
+	{
+		la_reply(10, "-95");
+		la_reply(10, AT_OK);
+	}
+	else if (strcmp(command, "AT+SNR=?") == 0)
+	{
+		la_reply(10, "4");
+		la_reply(10, AT_OK);
+	}
+	else if (sscanf(command, "AT+BAUDR=%lu", &baud) == 1)
+	{
+		// answered at the old baud rate, kept across resets
+		la_reply(10, AT_OK);
+		la_module_baud = baud;
+		
+		for (uint8_t i = 0; i < la_count; i++)
+		{
+			if (la_lines[i].time > now_us + 10000)
+			{
+				la_lines[i].baud = baud;
+			}
+		}
+	}
+	else if (strcmp(command, "AT+SLEEP=1") == 0)
+	{
+		la_reply(10, AT_OK);
+		la_sleeping = true;
+	}
+	else
+	{
+		// AT, AT+TXP, AT+BAUDR...
+		la_reply(10, AT_OK);
+	}
+}
+
+bool USART_0_is_tx_ready()
+{
+	return true;
+}
+
+bool USART_0_is_tx_busy()
+{
+	return false;
+}
+
+bool USART_0_is_rx_ready()
+{
+	return la_active && la_count > 0 && la_lines[0].time <= now_us;
+}
+
+uint8_t USART_0_read()
+{
+	if (!USART_0_is_rx_ready())
+	{
+		return 0;
+	}
+	
+	sim_line *line = &la_lines[0];
+	char c = line->text[la_pos++];
+	
+	// garbage at a wrong baud rate
+	if (line->baud != la_baud)
+	{
+		c = 0xFF;
+	}
+	
+	if (line->text[la_pos] == '\0')
+	{
+		la_count--;
+		memmove(&la_lines[0], &la_lines[1], la_count * sizeof(sim_line));
+		la_pos = 0;
+	}
+	
+	return c;
+}
+
+void USART_0_write(const uint8_t data)
+{
+	// 10 bits per character
+	advance(10000000UL / la_baud);
+	
+	if (!la_active || la_baud != la_module_baud)
+	{
+		return;
+	}
+	
+	if (data == '\n')
+	{
+		la_command[la_command_length] = '\0';
+		
+		if (la_command_length > 0 && la_command[la_command_length - 1] == '\r')
+		{
+			la_command[la_command_length - 1] = '\0';
+		}
+		
+		la_command_length = 0;
+		la_execute(la_command);
+	}
+	else if (la_command_length < sizeof(la_command) - 1)
+	{
+		la_command[la_command_length++] = data;
+	}
+}
+
+void USART_0_set_baud(const uint32_t baud)
+{
+	la_baud = baud;
+}
+
+bool USART_1_is_tx_ready()
+{
+	return true;
+}
+
+bool USART_1_is_tx_busy()
+{
+	return false;
+}
+
+void USART_1_write(const uint8_t data)
+{
+	// debug log at 9600 baud
+	advance(10000000UL / 9600);
+	
+	if (verbose)
+	{
+		putchar(data);
+	}
+}
+
+void LA_RESET_set_level(const bool level)
+{
+	if (level && !la_active)
+	{
+		la_join_us = now_us + LA66_JOIN_SECONDS * 1000000ULL;
+		joins++;
+		
+		// join request and accept, the accept comes in the RX1 window 5 s after the request
+		la_tx(la_join_us - 5000000ULL - LA66_getAirtime(dr, 23 - LA66_FRAME_OVERHEAD) * 1000ULL, la_join_us - 5000000ULL);
+		airtime_ms += LA66_getAirtime(dr, 23 - LA66_FRAME_OVERHEAD);
+		la_uas += LA66_getAirtime(dr, 23 - LA66_FRAME_OVERHEAD) / 1000.0 * (LA66_TX_UA - LA66_IDLE_UA);
+	}
+	
+	la_active = level;
+	la_sleeping = false;
+	la_count = 0;
+	la_pos = 0;
+	la_command_length = 0;
+	
+	if (level)
+	{
+		la_reply(LA66_JOIN_SECONDS * 1000, "JOINED");
+	}
+}
+
+void LA_TX_set_level(const bool level)
+{
+}
+
+void LA_RX_set_pull_mode(const enum port_pull_mode pull_mode)
+{
+}
+
+void ADC_POWER_set_level(const bool level)
+{
+	circuit = level;
+}
+
+void BAT_GND_set_level(const bool level)
+{
+}
+
+void ACTIVATE_set_level(const bool level)
+{
+	// releases the power latch, the device is off
+	if (!level)
+	{
+		deactivated = true;
+		finish();
+	}
+}
+
+void LED_TX_toggle_level(void)
+{
+}
+
+// ----------------------------------------------------------------------------------------------
+
+static uint8_t failures = 0;
+
+static void check(bool ok, const char *name)
+{
+	printf("%s %s\n", ok ? "ok  " : "FAIL", name);
+	
+	if (!ok)
+	{
+		failures++;
+	}
+}
+
+// Puts the LA66 to sleep, wakes it up and checks that it takes commands again.
+static void test_sleep()
+{
+	char payload[LA66_MAX_BUFF] = "0102";
+	uint8_t port = 1;
+	uint8_t rx_size = 0;
+	uint32_t sent;
+	
+	LA66_reset();
+	check(LA66_waitForJoin(NULL, 30) == LA66_SUCCESS, "LA66 joins");
+	
+	check(LA66_sleep() == LA66_SUCCESS, "LA66 acknowledges sleep");
+	check(la_sleeping && LA66_is_sleeping(), "LA66 sleeps");
+	
+	_delay_ms(60000);
+	
+	check(LA66_wakeup() == LA66_SUCCESS, "LA66 acknowledges wakeup");
+	check(!la_sleeping && !LA66_is_sleeping(), "LA66 is awake");
+	check(LA66_getTimestamp() != 0, "query after wakeup");
+	
+	sent = uplinks;
+	check(LA66_transmitB(&port, false, payload, &rx_size) == LA66_NODOWN && uplinks == sent + 1, "uplink after wakeup");
+	
+	LA66_deactivate();
+}
+
+// Waits within long timer periods sleep in idle mode and end within two counts of the period.
+static void test_idle()
+{
+	uint64_t start;
+	uint64_t active;
+	
+	sleep_seconds = 0;
+	set_tick_until(60);
+	
+	while (tick_period != TICK_LONG)
+	{
+		_delay_ms(100);
+	}
+	
+	start = now_us;
+	active = mcu_us[MCU_ACTIVE];
+	
+	idle_ms(3000);
+	
+	check(now_us - start >= 3000000 && now_us - start <= 3000000 + 2 * TICK_LONG * 1000000 / 256, "idle wait in long timer periods ends in time");
+	check(mcu_us[MCU_ACTIVE] - active < 10000, "idle wait in long timer periods sleeps");
+	
+	set_tick_until(0);
+	
+	while (tick_period != 1)
+	{
+		_delay_ms(100);
+	}
+	
+	// the battery part (MSR_BATTERY) starts with the settle stage (1 s)
+	uint8_t stage;
+	
+	measure_start(0x01);
+	stage = msr_stage;
+	
+	idle_until(NULL, 1500);
+	check(msr_stage == stage, "no task steps in waits deep in the call stack");
+	
+	idle_ms(10);
+	check(msr_stage != stage, "task steps in waits on a shallow stack");
+	
+	measure_finish();
+}
+
+// The battery is not sampled while the LA66 transmits, the battery sags then.
+static void test_battery()
+{
+	char payload[LA66_MAX_BUFF];
+	uint8_t port = 1;
+	uint8_t rx_size = 0;
+	uint8_t sim_dr = dr;
+	
+	LA66_reset();
+	LA66_waitForJoin(NULL, 30);
+	
+	// 40 bytes at DR0 are longer on air than the battery measurement takes, the lost acknowledgement adds a repeat
+	dr = 0;
+	memset(payload, '0', 80);
+	payload[80] = '\0';
+	la_lost_acks = 1;
+	
+	measure_start(0x01);
+	LA66_transmitB(&port, true, payload, &rx_size);
+	measure_finish();
+	
+	check(abs(volt_bat - battery_mv) <= 50, "battery not sampled while the LA66 transmits");
+	
+	dr = sim_dr;
+	LA66_deactivate();
+}
+
+// Syncs the time after interval s in which the clock was off by error s.
+static void sync_after(uint32_t interval, int32_t error)
+{
+	time_synced = true;
+	sync_timestamp = 1767225600UL + now_us / 1000000 - interval;
+	sync_uptime = get_uptime() - interval - error;
+	
+	sync_time();
+}
+
+// The drift is derived from long intervals without overflow, a jump of the time is no drift.
+static void test_drift()
+{
+	LA66_reset();
+	LA66_waitForJoin(NULL, 30);
+	
+	drift_ppm = 0;
+	sync_after(40UL * 24 * 60 * 60, 2600);
+	check(drift_ppm == CLOCK_DRIFT_MAX, "drift over 40 days clamped to CLOCK_DRIFT_MAX");
+	
+	drift_ppm = 0;
+	sync_after(24UL * 60 * 60, 3000);
+	check(drift_ppm == 0 && sync_interval == TIME_SYNC_MIN_INTERVAL, "clock jump of 3000 s not taken as drift");
+	
+	time_synced = false;
+	
+	LA66_deactivate();
+}
+
+// A cycle which took longer than tdc sleeps CYCLE_MIN_SLEEP, too short intervals are rejected.
+static void test_cycle()
+{
+	uint64_t start = now_us;
+	
+	tdc = 600;
+	cycle_start_day_seconds = day_seconds - 700;
+	
+	firmware_pause();
+	
+	check(now_us - start < (CYCLE_MIN_SLEEP + 2) * 1000000ULL, "cycle longer than tdc sleeps the minimum");
+	
+	tdc = INTERVAL_SECONDS;
+	
+	check(!handle_command(0x01, "\x00\x00\x0A", 3, false), "tdc below TDC_LOWEST rejected");
+	check(!handle_command(0x02, "\x00\x00\x14", 3, false), "tdc_min below TDC_LOWEST rejected");
+	check(handle_command(0x02, "\x00\x00\x3C", 3, false), "tdc_min of a minute accepted");
+}
+
+// An update preserving an EEPROM of the original layout leaves the added settings erased.
+static void test_settings()
+{
+	// everything after daily_confirmed_uplinks
+	for (uint8_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++)
+	{
+		if (settings[i].value != &tdc && settings[i].value != &msr_ms && settings[i].value != &max_volt &&
+			settings[i].value != &bat_low && settings[i].value != &bat_low_count_max && settings[i].value != &bat_low_min &&
+			settings[i].value != &daily_confirmed_uplinks)
+		{
+			memset(settings[i].value, 0xFF, settings[i].size);
+		}
+	}
+	
+	settings_layout = 0xFF;
+	tdc = 600;
+	
+	check(get_tdc() == 600, "erased adaptive tdc disabled");
+	
+	check_settings();
+	
+	check(settings_layout == SETTINGS_LAYOUT, "EEPROM layout updated");
+	check(alarm_volt == ALARM_VOLTAGE && rbe_fence_delta == RBE_FENCE_DELTA && msr_interval == MEASURE_INTERVAL &&
+		tdc_max == TDC_MAX && airtime_day == AIRTIME_DAY_BUDGET, "erased settings set to defaults");
+	check(tdc == 600, "original settings kept");
+	
+	// layout 1 only lacks tdc_min and tdc_max
+	settings_layout = 1;
+	alarm_volt = 1234;
+	la_baud = 9600;
+	tdc_min = 0xFFFFFFFF;
+	tdc_max = 0xFFFFFFFF;
+	
+	check_settings();
+	
+	check(tdc_min == TDC_MIN && tdc_max == TDC_MAX && settings_layout == SETTINGS_LAYOUT, "layout 1 migrated");
+	check(alarm_volt == 1234 && la_baud == 9600, "settings of layout 1 kept");
+	
+	tdc = INTERVAL_SECONDS;
+	alarm_volt = ALARM_VOLTAGE;
+	la_baud = LA66_BAUD;
+}
+
+// Every transmission of the LA66 is reported for the airtime accounting.
+static void test_airtime()
+{
+	char payload[LA66_MAX_BUFF] = "0102";
+	uint8_t port = 1;
+	uint8_t rx_size = 0;
+	
+	LA66_reset();
+	LA66_waitForJoin(NULL, 30);
+	
+	check(LA66_transmitB(&port, false, payload, &rx_size) == LA66_NODOWN && LA66_getTxCount() == 1, "unconfirmed uplink on air once");
+	
+	la_lost_acks = 1;
+	port = 1;
+	strcpy(payload, "0102");
+	check(LA66_transmitB(&port, true, payload, &rx_size) == LA66_SUCCESS && LA66_getTxCount() == 2, "confirmed uplink repeated after a lost acknowledgement");
+	
+	check(LA66_synctime() == LA66_SUCCESS && LA66_getTxCount() == 1, "DeviceTimeReq on air once");
+	
+	port = 1;
+	strcpy(payload, "010");
+	check(LA66_transmitB(&port, false, payload, &rx_size) == LA66_ERR_PARAM && uplinks_invalid == 1, "payload of odd length rejected");
+	
+	port = 1;
+	strcpy(payload, "01G2");
+	check(LA66_transmitB(&port, false, payload, &rx_size) == LA66_ERR_PARAM && uplinks_invalid == 2, "payload with non-hex digits rejected");
+	
+	uplinks_invalid = 0;
+	
+	LA66_deactivate();
+}
+
+static void run_tests()
+{
+	atmel_start_init();
+	end_us = UINT64_MAX;
+	
+	test_sleep();
+	test_airtime();
+	test_battery();
+	test_drift();
+	test_settings();
+	test_idle();
+	test_cycle();
+	
+	printf("%u tests failed\n", failures);
+	exit(failures > 0);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-d days] [-r dr] [-b battery mV] [-f fence V] [-c capacity mAh] [-s seed] [-p hh:mm,tdc,msr_ms,confirm] [-t] [-u] [-v] [setting=value...]\n", name);
+	fprintf(stderr, "Settings:");
+	
+	for (uint8_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++)
+	{
+		fprintf(stderr, " %s", settings[i].name);
+	}
+	
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int option;
+	
+	while ((option = getopt(argc, argv, "d:r:b:f:c:s:p:tuv")) != -1)
+	{
+		switch (option)
+		{
+			case 'd': days = atof(optarg); break;
+			case 'r': dr = atoi(optarg); break;
+			case 'b': battery_mv = atoi(optarg); break;
+			case 'f': fence_volt = atoi(optarg); break;
+			case 'c': capacity_mah = atoi(optarg); break;
+			case 's': seed = atol(optarg); break;
+			case 'p':
+			{
+				unsigned hours, minutes, tdc, msr_ms, confirm;
+				
+				if (profile_count == PROFILE_COUNT || sscanf(optarg, "%u:%u,%u,%u,%u", &hours, &minutes, &tdc, &msr_ms, &confirm) != 5)
+				{
+					usage(argv[0]);
+				}
+				
+				profiles[profile_count].start = hours * 60 + minutes;
+				profiles[profile_count].tdc = tdc;
+				profiles[profile_count].msr_ms = msr_ms;
+				profiles[profile_count].confirm = confirm;
+				profile_count++;
+				break;
+			}
+			case 't': test = true; break;
+			case 'u': print_uplinks = true; break;
+			case 'v': verbose = true; break;
+			default: usage(argv[0]);
+		}
+	}
+	
+	for (int i = optind; i < argc; i++)
+	{
+		char *value = strchr(argv[i], '=');
+		bool found = false;
+		
+		if (value == NULL)
+		{
+			usage(argv[0]);
+		}
+		
+		*value++ = '\0';
+		
+		for (uint8_t j = 0; j < sizeof(settings) / sizeof(settings[0]); j++)
+		{
+			if (strcmp(argv[i], settings[j].name) == 0)
+			{
+				uint32_t number = strtoul(value, NULL, 0);
+				
+				memcpy(settings[j].value, &number, settings[j].size);
+				found = true;
+			}
+		}
+		
+		if (!found)
+		{
+			usage(argv[0]);
+		}
+	}
+	
+	if (dr > 5)
+	{
+		usage(argv[0]);
+	}
+	
+	srand(seed);
+	
+	if (test)
+	{
+		run_tests();
+	}
+	
+	end_us = days * 86400 * 1000000;
+	
+	firmware_main();
+	
+	return 0;
+}